@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <functional>
+
+#include "InternalAllocator.h"
+
+struct CallsiteKey {
+    uint64_t size;
+    uint32_t stack_id;
+    // MemType
+    uint32_t mem_type;
+
+    bool operator==(const CallsiteKey& other) const {
+        return size == other.size && stack_id == other.stack_id &&
+               mem_type == other.mem_type;
+    }
+};
+
+struct CallsiteKeyHash {
+    size_t operator()(const CallsiteKey& key) const {
+        uint64_t h = key.size * 0x9e3779b97f4a7c15ULL ^
+                     (static_cast<uint64_t>(key.stack_id) << 2 | key.mem_type);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+};
+
+struct CallsiteInfo {
+    CallsiteKey key;
+    // 存活的分配个数
+    size_t count;
+    // 个数从 0 变为非 0 时那次分配的时间, 以及最近一次分配的时间 (TickClock 计数)
+    uint64_t first_ticks;
+    uint64_t last_ticks;
+    // 在变化记录中的位置, 不在其中时为 kNotChanged
+    uint32_t changed_pos;
+    // 是否以非 0 个数交出过, 交出过的条目归零后要留到下次交出, 告诉使用者删除
+    bool reported;
+};
+
+// 按 (堆栈, 大小, 类型) 汇总的存活分配. 汇总线程登记和删除指针记录时增量更新,
+// 峰值快照和输出只需要遍历调用点, 不再扫描全部指针.
+// 本身不加锁, 只由持有 drain_mutex_ 的消费者访问.
+class CallsiteTable {
+public:
+    void Clear();
+
+    void Add(const CallsiteKey& key, uint64_t ticks);
+    void Remove(const CallsiteKey& key);
+
+    // 开启后记录上次 TakeChanges 之后变化过的条目. 从未交出过的条目归零时
+    // 直接删除并移出变化记录, 留下的已归零条目不会多于上次交出的条目数
+    void TrackChanges(bool enable) { track_changes_ = enable; }
+    // 依次交出变化过的条目 (个数可能已经归零) 并清空变化记录
+    void TakeChanges(const std::function<void(const CallsiteInfo&)>& func);
+
+    // 遍历个数不为 0 的条目
+    template <typename Func>
+    void ForEach(Func&& func) const {
+        for (const CallsiteInfo& info : entries_) {
+            if (info.count != 0) {
+                func(info);
+            }
+        }
+    }
+
+    static constexpr uint32_t kNotChanged = UINT32_MAX;
+
+private:
+    void MarkChanged(uint32_t index);
+    void UnmarkChanged(uint32_t index);
+    void Release(uint32_t index);
+
+    InternalUnorderedMap<CallsiteKey, uint32_t, CallsiteKeyHash> index_;
+    // 下标固定不变, 释放的下标放进 free_ 复用
+    InternalVector<CallsiteInfo> entries_;
+    InternalVector<uint32_t> free_;
+    InternalVector<uint32_t> changed_;
+    bool track_changes_ = false;
+};
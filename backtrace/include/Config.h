@@ -7,7 +7,12 @@ constexpr uint64_t BACKTRACE = 0x1;                 // 记录堆栈
 constexpr uint64_t TRACK_ALLOCS = 0x2;              // 记录内存申请动作
 constexpr uint64_t BACKTRACE_SPECIFIC_SIZES = 0x4;  // 记录特定大小的内存申请
 constexpr uint64_t RECORD_MEMORY_PEAK = 0x8;        // 记录内存峰值
+constexpr uint64_t DROP_EVENTS_ON_FULL = 0x10;      // 队列满时丢弃记录
+constexpr uint64_t SAMPLE_ALLOCS = 0x20;            // 按字节间隔采样记录
+constexpr uint64_t FRAME_POINTER_UNWIND = 0x40;     // 按帧指针回溯堆栈
 constexpr uint64_t DUMP_ON_SINGAL = 0x80;           // 记录内存峰值
+constexpr uint64_t UNWIND_CACHE = 0x100;            // 复用上次回溯的外层帧
+constexpr uint64_t DUMP_POINTER_LIST = 0x200;  // 逐个指针输出, 而不是按调用点汇总
 
 class Config {
 public:
@@ -26,6 +31,8 @@ public:
 
     size_t backtrace_dump_peak_val() const { return backtrace_dump_peak_val_; }
 
+    size_t sample_interval_bytes() const { return sample_interval_bytes_; }
+
 private:
     int backtrace_dump_signal_ = 0;
 
@@ -38,5 +45,7 @@ private:
 
     size_t backtrace_dump_peak_val_ = 0;
 
+    size_t sample_interval_bytes_ = 0;
+
     uint64_t options_ = 0;
 };
\ No newline at end of file
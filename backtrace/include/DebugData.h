@@ -3,6 +3,8 @@
 #include <bionic/macros.h>
 
 #include "Config.h"
+#include "DmaBufTable.h"
+#include "GpuHandleTable.h"
 #include "PointerData.h"
 
 class DebugData {
@@ -17,6 +19,8 @@ public:
     bool TrackPointers() { return config_.options() & TRACK_ALLOCS; }
 
     std::unique_ptr<PointerData> pointer;
+    DmaBufTable dma_bufs;
+    GpuHandleTable gpu_handles;
 
 private:
     Config config_;
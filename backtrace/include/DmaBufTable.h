@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "InternalAllocator.h"
+
+class PointerData;
+
+struct DmaBuf {
+    uint64_t inode;
+    // fdinfo 中的导出者名字和 buffer 大小
+    char exp_name[32];
+    size_t size;
+    // 引用这个 buffer 的 fd 和映射个数, 都归零后 buffer 不再计入
+    uint32_t fd_refs;
+    uint32_t map_refs;
+    // 为 false 时字节数已由其它记录计入, 例如旧版 ION 的 handle
+    bool accounted;
+};
+
+// dma-buf 对象表, 按 inode 记录每个 buffer, 由 fd 和映射共同引用计数.
+// buffer 从第一次出现到最后一个 fd 关闭且最后一个映射解除之间计入 DMA 内存,
+// 在 PointerData 中以 DmaBuf 对象的地址作为记录的 key. 对象来自 InternalArena,
+// 不会与应用的地址冲突, 并且在删除记录之后才释放.
+//
+// 所有 dma-buf 都是同一个伪文件系统上的 inode, 用 fstat 得到的 st_dev 就能判断,
+// 新出现的设备读一次 fdinfo 确认是不是这个文件系统, 新出现的 buffer 读一次
+// fdinfo 取导出者名字和大小. 由分配 ioctl 得到的 fd 在分配时就登记, 没有被
+// 映射过的 buffer 也能计入. inode 编号由内核递增分配, 不会复用.
+class DmaBufTable {
+public:
+    // pointer 为空时只维护引用计数, 不记录分配
+    void Initialize(PointerData* pointer) { pointer_ = pointer; }
+
+    // close/dup 等 hook 的快速路径: 不加锁, 只测一位. 位图中还有 GpuHandleTable
+    // 标记的设备 fd. 返回 false 时 fd 一定不引用已知的 dma-buf 或 GPU 设备.
+    static bool MaybeDmaBufFd(int fd) {
+        if (fd < 0) {
+            return false;
+        }
+        if (static_cast<size_t>(fd) >= kFdBitmapBits) {
+            return high_fds_.load(std::memory_order_relaxed) != 0;
+        }
+        return (fd_bits_[fd / 64].load(std::memory_order_relaxed) >> (fd % 64)) & 1;
+    }
+
+    // mmap 成功后调用. fd 是 dma-buf 时登记映射并返回 true
+    bool Map(int fd, const void* addr);
+    // 导出 dma-buf 的 ioctl 成功后调用, 在分配时记录 buffer 和分配者的堆栈,
+    // 之后的 mmap 不会重复计入. size 为 0 时从 fd 查询大小.
+    // account 为 false 时只跟踪 fd, 字节数已经由别处计入
+    void AddExported(int fd, size_t size, bool account = true);
+    // munmap 时调用
+    void Unmap(const void* addr);
+    // close 之前调用
+    void CloseFd(int fd);
+    // dup 类调用成功后调用. new_fd 原先引用的 buffer 已被内核关闭,
+    // 之后 new_fd 与 old_fd 引用同一个 buffer
+    void DupFd(int old_fd, int new_fd);
+
+    // 标记或清除 fd, 被标记的 fd 的 close 和 dup 类调用会进入 hook 的慢速路径.
+    // 同一个 fd 的标记和清除必须成对调用
+    static void SetFdBit(int fd, bool set);
+
+private:
+    // 以下函数的调用者持有 mutex_
+    // 设备未确认时也返回 true, 由 FindOrCreate 读 fdinfo 确认
+    bool IsDmaBufDevice(dev_t dev);
+    // exported 为 true 时 fd 已知是 dma-buf, 不要求 fdinfo 中有 exp_name
+    DmaBuf* FindOrCreate(
+            int fd, dev_t dev, uint64_t inode, bool exported, size_t size,
+            bool account);
+    void BindFd(int fd, DmaBuf* buffer);
+    void UnbindFd(int fd);
+    void ReleaseIfUnused(DmaBuf* buffer);
+
+    // 位图覆盖的 fd 范围, 更大的 fd 记在 high_fds_ 计数里
+    static constexpr size_t kFdBitmapBits = 65536;
+    // 静态零初始化, 在构造函数运行前就可以读取
+    static std::atomic<uint64_t> fd_bits_[kFdBitmapBits / 64];
+    static std::atomic<size_t> high_fds_;
+
+    PointerData* pointer_ = nullptr;
+    std::mutex mutex_;
+    bool dma_buf_dev_known_ = false;
+    dev_t dma_buf_dev_ = 0;
+    // 已确认不是 dma-buf 文件系统的设备, 进程里一般只有几个
+    InternalVector<dev_t> other_devs_;
+    InternalUnorderedMap<uint64_t, DmaBuf*> buffers_;
+    InternalUnorderedMap<int, DmaBuf*> fds_;
+    InternalUnorderedMap<uintptr_t, DmaBuf*> mappings_;
+    std::atomic<size_t> mapping_count_{0};
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "InternalAllocator.h"
+#include "PointerData.h"
+
+enum GpuDriver : uint32_t { kMaliDriver, kKgslDriver, kIonDriver };
+
+// 驱动内的分配句柄: Mali 是 gpu_va, KGSL 是 id, 旧版 ION 是 handle.
+// 句柄只在打开设备的 fd 内唯一.
+struct GpuHandleKey {
+    int fd;
+    uint32_t driver;
+    uint64_t handle;
+
+    bool operator==(const GpuHandleKey& other) const {
+        return fd == other.fd && driver == other.driver && handle == other.handle;
+    }
+};
+
+struct GpuHandleKeyHash {
+    size_t operator()(const GpuHandleKey& key) const {
+        uint64_t h = key.handle * 0x9e3779b97f4a7c15ULL ^
+                     (static_cast<uint64_t>(key.fd) << 2 | key.driver);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+};
+
+struct GpuAllocation {
+    GpuHandleKey key;
+    size_t size;
+    // Mali same-VA 分配映射到 CPU 后的地址, munmap 这个地址即释放分配
+    uintptr_t free_on_unmap;
+};
+
+// 驱动分配句柄表. 分配 ioctl 成功后按句柄登记并记录分配者的堆栈, 释放 ioctl
+// 按句柄删除, 不依赖分配之后是否被 mmap. 与 DmaBufTable 一样, 在 PointerData 中
+// 以 GpuAllocation 对象的地址作为记录的 key.
+class GpuHandleTable {
+public:
+    // pointer 为空时不记录
+    void Initialize(PointerData* pointer) { pointer_ = pointer; }
+
+    // type 为 GPU, 旧版 ION 的 handle 为 DMA
+    void Add(const GpuHandleKey& key, size_t size, MemType type);
+    void Remove(const GpuHandleKey& key);
+    bool Contains(const GpuHandleKey& key);
+
+    // Mali same-VA 分配先返回一个 cookie, 用户以 cookie 为偏移 mmap 设备 fd 后,
+    // 分配改由映射地址标识. mmap 设备 fd 成功后调用
+    void MapCookie(int fd, uint64_t offset, const void* addr);
+    // munmap 时调用
+    void Unmap(const void* addr);
+    // 设备 fd 被 close 或被 dup2/dup3 覆盖时调用, 驱动随 fd 释放其上的所有分配.
+    // 仍被映射的 same-VA 分配要等 munmap 才释放. fd 被 dup 过时文件其实还未关闭,
+    // 这种用法很少见, 不单独处理
+    void CloseFd(int fd);
+
+    // Mali 用来表示 cookie 的 gpu_va 范围 (BASE_MEM_COOKIE_BASE 起的 64 页)
+    static constexpr uint64_t kMaliCookieBase = 64ULL << 12;
+    static constexpr uint64_t kMaliCookieEnd = kMaliCookieBase + (64ULL << 12);
+
+private:
+    // 调用者持有 mutex_
+    void Release(GpuAllocation* allocation);
+
+    PointerData* pointer_ = nullptr;
+    std::mutex mutex_;
+    InternalUnorderedMap<GpuHandleKey, GpuAllocation*, GpuHandleKeyHash> handles_;
+    InternalUnorderedMap<uintptr_t, GpuAllocation*> unmap_frees_;
+    // 登记过分配的设备 fd, 已在 DmaBufTable 的 fd 位图中标记
+    InternalVector<int> device_fds_;
+    // 大多数 mmap/munmap 与 GPU 分配无关, 先看计数
+    std::atomic<size_t> pending_cookies_{0};
+    std::atomic<size_t> unmap_free_count_{0};
+};
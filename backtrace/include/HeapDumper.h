@@ -0,0 +1,23 @@
+#pragma once
+
+#include "PointerData.h"
+
+// 后台 dump 线程. 触发 dump 的线程只在 BlockAllOperations 期间复制汇总表,
+// 符号化、格式化和写文件都交给这里, 其它线程不必等输出完成.
+class HeapDumper {
+public:
+    // 注册 fork 处理, 在 debug_initialize 中调用
+    static void Initialize();
+
+    // 接管由 NewSnapshot 得到的快照, 排队写入 file_name.
+    // wait 为 true 时等写完再返回. dump 线程无法启动时在调用线程上直接写.
+    static void Submit(const char* file_name, DumpSnapshot* snapshot, bool wait);
+
+    // 在调用线程上直接写入并释放快照
+    static void Write(const char* file_name, DumpSnapshot* snapshot);
+
+    // 等待已排队的 dump 全部写完
+    static void Flush();
+
+    static DumpSnapshot* NewSnapshot();
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 工具自身数据结构使用的内存池, 直接由匿名 mmap 提供.
+// 不经过被测量的 malloc, 避免工具的簿记放大应用的碎片和 RSS.
+class InternalArena {
+public:
+    static void* Allocate(size_t bytes);
+    static void Free(void* ptr, size_t bytes);
+
+    // 整页映射, 供 PointerTable 等自行管理内存的结构使用, 同样计入工具内存
+    static void* MapPages(size_t bytes);
+    static void* RemapPages(void* addr, size_t old_bytes, size_t new_bytes);
+    static void UnmapPages(void* addr, size_t bytes);
+
+    // 工具向系统映射的总字节数, 以及其中正在被数据结构使用的字节数
+    static size_t mapped_bytes() {
+        return mapped_bytes_.load(std::memory_order_relaxed);
+    }
+    static size_t used_bytes() { return used_bytes_.load(std::memory_order_relaxed); }
+
+private:
+    static std::atomic<size_t> mapped_bytes_;
+    static std::atomic<size_t> used_bytes_;
+};
+
+template <typename T>
+struct InternalAllocator {
+    using value_type = T;
+
+    InternalAllocator() noexcept = default;
+    template <typename U>
+    InternalAllocator(const InternalAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(InternalArena::Allocate(n * sizeof(T)));
+    }
+    void deallocate(T* ptr, size_t n) { InternalArena::Free(ptr, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const InternalAllocator<U>&) const noexcept {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const InternalAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+template <typename T>
+using InternalVector = std::vector<T, InternalAllocator<T>>;
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+using InternalUnorderedMap = std::unordered_map<
+        Key, Value, Hash, std::equal_to<Key>,
+        InternalAllocator<std::pair<const Key, Value>>>;
+
+using InternalString =
+        std::basic_string<char, std::char_traits<char>, InternalAllocator<char>>;
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "dma_heap/dma-heap.h"
+#include "ion/ion.h"
+// ion_4.12.h 与 ion_4.19.h 的请求编码相同, 只需包含一个
+#include "ion/ion_4.19.h"
+#include "midgard/mali_kbase_ioctl.h"
+#include "msm_ksgl/msm_ksgl.h"
+#include "udmabuf/udmabuf.h"
+
+// 进程里绝大多数 ioctl (binder, input 等) 与内存无关, hook 入口先按请求号分类,
+// 不需要跟踪的请求不加锁也不写 TLS. 请求号在编译期就是常量, switch 由编译器
+// 生成跳转表或二分比较; 两个请求编码相同时 case 重复, 编译直接失败.
+// 增加跟踪的请求时要同时在 malloc_debug.cpp 的 TrackAllocIoctl 中解析.
+constexpr bool IsTrackedIoctl(unsigned int request) {
+    switch (request) {
+        // 返回新的 dma-buf fd
+        case DMA_HEAP_IOCTL_ALLOC:
+        case ION_IOC_NEW_ALLOC:
+        case ION_IOC_SHARE:
+        case ION_IOC_MAP:
+        case UDMABUF_CREATE:
+        case UDMABUF_CREATE_LIST:
+        // 按驱动句柄分配和释放
+        case ION_IOC_ALLOC:
+        case ION_IOC_FREE:
+        case KBASE_IOCTL_MEM_ALLOC:
+        case KBASE_IOCTL_MEM_ALLOC_EX:
+        case KBASE_IOCTL_MEM_FREE:
+        case IOCTL_KGSL_GPUOBJ_ALLOC:
+        case IOCTL_KGSL_GPUMEM_ALLOC_ID:
+        case IOCTL_KGSL_GPUOBJ_FREE:
+        case IOCTL_KGSL_GPUMEM_FREE_ID:
+            return true;
+        default:
+            return false;
+    }
+}
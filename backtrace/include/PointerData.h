@@ -3,6 +3,8 @@
 #include <fcntl.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -14,74 +16,133 @@
 #include <bionic/macros.h>
 #include <unwindstack/Unwinder.h>
 
+#include "CallsiteTable.h"
 #include "Config.h"
+#include "InternalAllocator.h"
+#include "PointerTable.h"
+#include "StackTable.h"
+#include "TickClock.h"
 
-enum MemType { HOST, MMAP, DMA };
-
-struct FrameKeyType {
-    size_t num_frames;
-    uintptr_t* frames;
-
-    bool operator==(const FrameKeyType& comp) const {
-        if (num_frames != comp.num_frames)
-            return false;
-        for (size_t i = 0; i < num_frames; i++) {
-            if (frames[i] != comp.frames[i]) {
-                return false;
-            }
-        }
-        return true;
+enum MemType { HOST, MMAP, DMA, GPU };
+
+// 每个存活指针一条记录, 压缩到 16 字节: 大小 48 位, 类型 2 位, 分配时间 46 位,
+// 堆栈编号 32 位. 分配时间是 TickClock::Compress 后的计数.
+struct PointerInfoType {
+    static constexpr int kSizeBits = 48;
+    static constexpr int kTimeLowBits = 32;
+
+    uint64_t size : kSizeBits;
+    uint64_t mem_type : 2;
+    uint64_t time_high : 64 - kSizeBits - 2;
+    uint32_t time_low;
+    uint32_t stack_id;
+
+    static PointerInfoType Pack(
+            size_t size, uint32_t stack_id, MemType mem_type, uint64_t ticks) {
+        uint64_t time = TickClock::Compress(ticks);
+        PointerInfoType info;
+        info.size = size;
+        info.mem_type = mem_type;
+        info.time_high = time >> kTimeLowBits;
+        info.time_low = static_cast<uint32_t>(time);
+        info.stack_id = stack_id;
+        return info;
     }
-};
 
-// 新增 hash 算法
-namespace std {
-template <>
-struct hash<FrameKeyType> {
-    std::size_t operator()(const FrameKeyType& key) const {
-        std::size_t cur_hash = key.frames[0];
-        // Limit the number of frames to speed up hashing.
-        size_t max_frames = (key.num_frames > 5) ? 5 : key.num_frames;
-        for (size_t i = 1; i < max_frames; i++) {
-            cur_hash ^= key.frames[i];
-        }
-        return cur_hash;
+    size_t Size() const { return size; }
+    MemType Type() const { return static_cast<MemType>(mem_type); }
+    uint64_t AllocTicks() const {
+        return TickClock::Expand(
+                static_cast<uint64_t>(time_high) << kTimeLowBits | time_low);
+    }
+    static size_t MaxSize() {
+        return static_cast<size_t>(
+                std::min<uint64_t>((uint64_t{1} << kSizeBits) - 1, SIZE_MAX));
     }
 };
-};  // namespace std
+static_assert(sizeof(PointerInfoType) == 16, "pointer record must stay packed");
 
-struct FrameInfoType {
-    size_t references = 0;
-    std::vector<uintptr_t> frames;
+struct ListInfoType {
+    uintptr_t pointer;
+    size_t num_allocations;
+    size_t size;
+    MemType mem_type;
+    // 堆栈登记后不再释放, 输出时直接按编号读取
+    uint32_t stack_id;
+    uint64_t alloc_ticks;
 };
+using Pred = std::function<bool(const ListInfoType&, const ListInfoType&)>;
 
-// 新增 timeval 比较函数
-inline bool operator<(const timeval& lhs, const timeval& rhs) {
-    // Convert both times to microseconds and compare directly
-    long long l_time = static_cast<long long>(lhs.tv_sec) * 1000000 + lhs.tv_usec;
-    long long r_time = static_cast<long long>(rhs.tv_sec) * 1000000 + rhs.tv_usec;
-    return l_time < r_time;
-}
+// unwind 的结果, 由 hook 所在线程生成, 交给汇总线程去重后登记
+struct StackCapture {
+    // 全部帧的哈希, 在回溯的线程上算好
+    uint64_t hash;
+    InternalVector<uintptr_t> frames;
+    InternalVector<uint32_t> map_ids;
+};
 
-struct PointerInfoType {
-    size_t size;
-    size_t hash_index;
-    MemType mem_type;
-    timeval alloc_time;
-    size_t RealSize() const { return size & ~(1U << 31); }
-    static size_t MaxSize() { return (1U << 31) - 1; }
+// 每线程一个单生产者/单消费者环形队列. hook 只写入定长记录,
+// 查表, 堆栈去重和峰值统计都由后台汇总线程完成.
+constexpr size_t kEventRingSize = 1024;
+// 释放时向前查找本线程未消费分配的最大距离
+constexpr size_t kLocalCancelWindow = 256;
+
+enum EventKind : uint8_t {
+    kEventAdd,
+    kEventRemove,
+    // 分配在被消费前就被同一线程释放, 只计入峰值, 不再访问表
+    kEventCancelledAdd,
+    kEventCancelledRemove,
+    // 消费者已取走的分配, 生产者不能再抵消
+    kEventConsumed,
 };
 
-struct ListInfoType {
+struct AllocEvent {
     uintptr_t pointer;
-    size_t num_allocations;
     size_t size;
+    StackCapture* stack;
+    uint64_t ticks;
+    // 生产者 (抵消) 和消费者 (取走) 通过 CAS 争用分配记录
+    std::atomic<uint8_t> kind;
     MemType mem_type;
-    FrameInfoType* frame_info;
-    std::shared_ptr<std::vector<unwindstack::FrameData>> backtrace_info;
-    timeval alloc_time;
 };
-using Pred = std::function<bool(const ListInfoType&, const ListInfoType&)>;
+
+struct ThreadEventRing {
+    // 是否被某个存活线程占用, 线程退出后记录可被新线程复用
+    std::atomic<bool> in_use;
+    ThreadEventRing* next;
+    // 采样状态只由生产者线程使用: 距离下一个采样点的字节数和随机数状态
+    int64_t bytes_until_sample;
+    uint64_t sample_rng;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    AllocEvent events[kEventRingSize];
+};
+
+// pointer 表按地址哈希分片, 单个分片小, 扩容和遍历时不会长时间停顿.
+// 分片只由持有 drain_mutex_ 的消费者访问, 不再单独加锁
+constexpr size_t kPointerShardBits = 6;
+constexpr size_t kPointerShards = 1 << kPointerShardBits;
+
+struct PointerShard {
+    PointerTable<PointerInfoType> pointers;
+};
+
+// dump 的快照. 复制时其它线程都停在 hook 之外, 之后的排序, 符号化和写文件
+// 不再持有任何表的锁
+struct DumpSnapshot {
+    // 逐个指针输出时使用 pointers, 否则使用 callsites
+    bool list_pointers;
+    bool sort_by_bytes;
+    InternalVector<ListInfoType> pointers;
+    InternalVector<CallsiteInfo> callsites;
+    size_t tool_used_bytes;
+    size_t tool_mapped_bytes;
+    size_t dropped_events;
+    size_t dropped_bytes;
+};
+
+class DumpWriter;
 
 class PointerData {
 public:
@@ -91,11 +152,17 @@ public:
     bool Initialize(const Config& config);
 
     void Add(const void* ptr, size_t size, MemType type = HOST);
-    size_t AddBacktrace(size_t num_frames, size_t size_bytes);
     void Remove(const void* ptr);
-    void RemoveBacktrace(size_t hash_index);
 
-    void DumpLiveToFile(int fd);
+    // 在调用线程上消费所有线程队列中的记录. 调用者必须已经 BlockAllOperations.
+    void DrainAllRings();
+    // 通知并停止汇总线程, 之后的记录只在 DrainAllRings 中消费
+    void StopAggregator();
+
+    // 复制 dump 需要的汇总表. 调用者必须已经 BlockAllOperations 并 DrainAllRings
+    void Snapshot(DumpSnapshot* snapshot);
+    // 格式化快照并写入 fd, 可以在任意线程上与 hook 并发执行
+    void WriteSnapshot(int fd, DumpSnapshot* snapshot);
     void DumpPeakInfo();
 
 private:
@@ -104,22 +171,75 @@ private:
         return pointer ^ UINTPTR_MAX;
     }
 
-    void GetList(std::vector<ListInfoType>* list, bool only_with_backtrace, Pred pred);
-    void GetUniqueList(std::vector<ListInfoType>* list, bool only_with_backtrace);
-
-    std::mutex pointer_mutex_;
-    std::unordered_map<uintptr_t, PointerInfoType> pointers_;
-
-    std::mutex frame_mutex_;
-    std::unordered_map<FrameKeyType, size_t> key_to_index_;
-    std::unordered_map<size_t, FrameInfoType> frames_;
-    std::unordered_map<size_t, std::shared_ptr<std::vector<unwindstack::FrameData>>>
-            backtraces_info_;
-    size_t cur_hash_index_;
+    static inline size_t ShardIndex(uintptr_t mangled_ptr) {
+        // 乘法混合后取高位, 对齐地址的低位全相同, 不能直接取模
+        uint64_t hash = static_cast<uint64_t>(mangled_ptr) * 0x9e3779b97f4a7c15ULL;
+        return static_cast<size_t>(hash >> (64 - kPointerShardBits));
+    }
+    PointerShard& Shard(uintptr_t mangled_ptr) {
+        return pointer_shards_[ShardIndex(mangled_ptr)];
+    }
 
-    size_t current_used, current_host, current_dma;
-    size_t peak_tot, peak_host, peak_dma;
-    std::vector<ListInfoType> peak_list;
+    // 返回 false 表示命中了需要跳过的函数, 不记录这次分配
+    bool CaptureBacktrace(size_t size_bytes, StackCapture** capture);
+    uint32_t InternBacktrace(StackCapture* capture);
+
+    ThreadEventRing* CurrentRing();
+    ThreadEventRing* RegisterRing();
+    // 队列已满时按配置阻塞等待或丢弃, 返回 false 表示丢弃
+    bool WaitForSpace(ThreadEventRing* ring, bool droppable);
+    void Push(
+            ThreadEventRing* ring, EventKind kind, uintptr_t pointer, size_t size,
+            StackCapture* stack, uint64_t ticks, MemType type);
+    static void RingThreadExit(void* data);
+    static void AtForkChild();
+    static void* AggregatorMain(void* data);
+    void StartAggregator();
+
+    // 按时间顺序消费所有队列中不晚于 watermark 的记录, 调用者持有 drain_mutex_
+    void DrainRings(uint64_t watermark);
+    void ProcessEvent(AllocEvent* event);
+    void UpdateUsage(MemType type, int64_t bytes);
+
+    // 采样模式下决定这次 host 分配是否被记录
+    bool ShouldSample(ThreadEventRing* ring, size_t size);
+    int64_t NextSampleInterval(ThreadEventRing* ring);
+    // 采样记录代表的字节数期望值 size / P(被采中), 非采样模式下就是 size.
+    // 结果只取决于参数, 分配和释放时加减的值总能抵消.
+    size_t EstimatedSize(size_t size, MemType type) const;
+
+    void RecordPeak();
+    void GetList(
+            InternalVector<ListInfoType>* list, bool only_with_backtrace, Pred pred);
+    // 当前或最近一次峰值时有堆栈的调用点
+    void GetCallsites(InternalVector<CallsiteInfo>* list, bool at_peak);
+    void DumpCallsites(
+            DumpWriter& writer, const InternalVector<CallsiteInfo>& callsites,
+            bool sort_by_bytes);
+
+    PointerShard pointer_shards_[kPointerShards];
+
+    StackTable stacks_;
+    // 存活分配按调用点的汇总, 只由持有 drain_mutex_ 的消费者访问
+    CallsiteTable callsites_;
+
+    // 计数器只由持有 drain_mutex_ 的消费者按记录的时间顺序更新, 峰值是精确值
+    std::atomic<size_t> current_used, current_host, current_dma, current_gpu;
+    std::atomic<size_t> peak_tot, peak_host, peak_dma, peak_gpu;
+    // 创下新峰值后推迟到用量回落前再记录快照, 持续增长时不必每次都扫描全表
+    bool peak_pending_;
+
+    // 采样平均间隔, 0 表示记录所有分配
+    size_t sample_interval_;
+
+    std::mutex drain_mutex_;
+    // 丢弃模式下因队列满而丢掉的分配
+    std::atomic<size_t> dropped_events_, dropped_bytes_;
+
+    std::mutex peak_mutex_;
+    size_t peak_list_used_;
+    // 峰值时刻的调用点快照, 每次创下新峰值时只合入变化过的条目
+    InternalUnorderedMap<CallsiteKey, CallsiteInfo, CallsiteKeyHash> peak_callsites_;
 
     BIONIC_DISALLOW_COPY_AND_ASSIGN(PointerData);
 };
\ No newline at end of file
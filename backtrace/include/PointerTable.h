@@ -0,0 +1,223 @@
+#pragma once
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <type_traits>
+
+#include <bionic/macros.h>
+
+#include "InternalAllocator.h"
+
+// 地址 -> 记录的开放寻址哈希表 (线性探测).
+// 存储直接来自 InternalArena 的整页映射, 不经过被测量的 malloc,
+// 工具自身的簿记不会出现在应用的堆统计里.
+// key 为 0 表示空槽; 删除使用 backward shift, 不留墓碑.
+// 本身不加锁, 由调用者 (PointerData 的分片锁) 保证互斥.
+template <typename Value>
+class PointerTable {
+    static_assert(std::is_trivially_copyable<Value>::value, "value must be POD");
+
+public:
+    PointerTable() = default;
+    ~PointerTable() { Release(); }
+
+    size_t size() const { return size_; }
+    size_t mapped_bytes() const { return slots_ == nullptr ? 0 : MapSize(capacity_); }
+
+    Value* Find(uintptr_t key) {
+        if (size_ == 0) {
+            return nullptr;
+        }
+        for (size_t i = HomeIndex(key);; i = (i + 1) & mask_) {
+            if (slots_[i].key == key) {
+                return &slots_[i].value;
+            }
+            if (slots_[i].key == 0) {
+                return nullptr;
+            }
+        }
+    }
+
+    // 插入或覆盖. key 为 0 时无法存储, 返回 false.
+    bool Insert(uintptr_t key, const Value& value) {
+        if (key == 0) {
+            return false;
+        }
+        // 负载因子不超过 3/4
+        if (slots_ == nullptr || (size_ + 1) * 4 > capacity_ * 3) {
+            if (!Grow()) {
+                return false;
+            }
+        }
+        size_t i = HomeIndex(key);
+        while (slots_[i].key != 0 && slots_[i].key != key) {
+            i = (i + 1) & mask_;
+        }
+        if (slots_[i].key == 0) {
+            slots_[i].key = key;
+            size_++;
+        }
+        slots_[i].value = value;
+        return true;
+    }
+
+    bool Erase(uintptr_t key, Value* value = nullptr) {
+        if (size_ == 0) {
+            return false;
+        }
+        size_t i = HomeIndex(key);
+        while (slots_[i].key != key) {
+            if (slots_[i].key == 0) {
+                return false;
+            }
+            i = (i + 1) & mask_;
+        }
+        if (value != nullptr) {
+            *value = slots_[i].value;
+        }
+        // backward shift: 把后续仍能前移的元素挪进空洞, 保持探测链连续
+        size_t hole = i;
+        for (size_t j = (i + 1) & mask_; slots_[j].key != 0; j = (j + 1) & mask_) {
+            size_t home = HomeIndex(slots_[j].key);
+            // home 不在 (hole, j] 区间内 (环形) 时才能移动到 hole
+            if (((j - home) & mask_) >= ((j - hole) & mask_)) {
+                slots_[hole] = slots_[j];
+                hole = j;
+            }
+        }
+        slots_[hole].key = 0;
+        size_--;
+        return true;
+    }
+
+    template <typename Func>
+    void ForEach(Func&& func) const {
+        if (slots_ == nullptr) {
+            return;
+        }
+        for (size_t i = 0; i < capacity_; i++) {
+            if (slots_[i].key != 0) {
+                func(slots_[i].key, slots_[i].value);
+            }
+        }
+    }
+
+    void Clear() { Release(); }
+
+private:
+    struct Slot {
+        uintptr_t key;
+        Value value;
+    };
+
+    static constexpr size_t kInitialCapacity = 256;
+
+    static size_t MapSize(size_t capacity) {
+        size_t page_size = getpagesize();
+        return (capacity * sizeof(Slot) + page_size - 1) & ~(page_size - 1);
+    }
+
+    inline size_t HomeIndex(uintptr_t key) const {
+        // murmur3 fmix64, 与 PointerData 选择分片用的哈希相互独立
+        uint64_t h = key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return static_cast<size_t>(h) & mask_;
+    }
+
+    bool Grow() {
+        if (slots_ == nullptr) {
+            slots_ = static_cast<Slot*>(
+                    InternalArena::MapPages(MapSize(kInitialCapacity)));
+            if (slots_ == nullptr) {
+                return false;
+            }
+            capacity_ = kInitialCapacity;
+            mask_ = capacity_ - 1;
+            return true;
+        }
+
+        size_t old_capacity = capacity_;
+        size_t new_capacity = old_capacity * 2;
+        // mremap 扩大映射, 新增部分由内核清零, 即全部是空槽
+        void* addr = InternalArena::RemapPages(
+                slots_, MapSize(old_capacity), MapSize(new_capacity));
+        if (addr == nullptr) {
+            return false;
+        }
+        // pending 位图标记还没有按新容量重新放置的元素
+        size_t bitmap_bytes = (old_capacity + 7) / 8;
+        uint8_t* pending = static_cast<uint8_t*>(InternalArena::MapPages(bitmap_bytes));
+        if (pending == nullptr) {
+            InternalArena::UnmapPages(addr, MapSize(new_capacity));
+            slots_ = nullptr;
+            capacity_ = size_ = 0;
+            return false;
+        }
+
+        slots_ = static_cast<Slot*>(addr);
+        capacity_ = new_capacity;
+        mask_ = new_capacity - 1;
+        RehashInPlace(old_capacity, pending);
+        InternalArena::UnmapPages(pending, bitmap_bytes);
+        return true;
+    }
+
+    // 原地重排: 每个 pending 元素沿新的探测序列找到第一个空槽或 pending 槽.
+    // 空槽直接搬过去; pending 槽则交换, 换回来的元素继续在当前位置处理.
+    // 已放置的元素只会经过已放置的槽, 清空 pending 槽不会打断它们的探测链.
+    void RehashInPlace(size_t old_capacity, uint8_t* pending) {
+        auto is_pending = [pending](size_t i) {
+            return (pending[i >> 3] >> (i & 7)) & 1;
+        };
+        auto clear_pending = [pending](size_t i) {
+            pending[i >> 3] &= ~(1 << (i & 7));
+        };
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (slots_[i].key != 0) {
+                pending[i >> 3] |= 1 << (i & 7);
+            }
+        }
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            while (is_pending(i)) {
+                size_t j = HomeIndex(slots_[i].key);
+                while (slots_[j].key != 0 && !(j < old_capacity && is_pending(j))) {
+                    j = (j + 1) & mask_;
+                }
+                if (j == i) {
+                    clear_pending(i);
+                } else if (slots_[j].key == 0) {
+                    slots_[j] = slots_[i];
+                    slots_[i].key = 0;
+                    clear_pending(i);
+                } else {
+                    Slot tmp = slots_[j];
+                    slots_[j] = slots_[i];
+                    slots_[i] = tmp;
+                    clear_pending(j);
+                }
+            }
+        }
+    }
+
+    void Release() {
+        if (slots_ != nullptr) {
+            InternalArena::UnmapPages(slots_, MapSize(capacity_));
+        }
+        slots_ = nullptr;
+        capacity_ = mask_ = size_ = 0;
+    }
+
+    Slot* slots_ = nullptr;
+    size_t capacity_ = 0;
+    size_t mask_ = 0;
+    size_t size_ = 0;
+
+    BIONIC_DISALLOW_COPY_AND_ASSIGN(PointerTable);
+};
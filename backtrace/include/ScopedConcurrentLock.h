@@ -0,0 +1,87 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include <bionic/macros.h>
+
+#include "debug_disable.h"
+
+// 每个线程独占一条 cache line 的 epoch 记录. hook 的快路径只读写本线程的记录,
+// 不再像 pthread_rwlock 那样让所有核心争抢同一条 cache line.
+struct alignas(64) ThreadEpoch {
+    // 当前线程正在执行的 hook 调用层数, 0 表示处于静默(quiescent)状态
+    std::atomic<uint32_t> active;
+    // 记录是否被某个存活线程占用, 线程退出后可被新线程复用
+    std::atomic<bool> in_use;
+    ThreadEpoch* next;
+};
+
+// 所有 hook 调用的并发保护. 构造时标记本线程进入, 析构时标记退出;
+// BlockAllOperations 阻止新的调用进入并等待所有线程的进行中调用排空.
+class ScopedConcurrentLock {
+public:
+    ScopedConcurrentLock() { Enter(); }
+    ~ScopedConcurrentLock() { Exit(); }
+
+    static void Init();
+
+    // 阻止所有线程进入 hook, 并等待已进入的调用全部退出. 调用线程自身不受影响.
+    static void BlockAllOperations();
+    static void UnblockAllOperations();
+
+private:
+    static inline void Enter() {
+        ThreadEpoch* epoch = CurrentEpoch();
+        if (__builtin_expect(epoch == nullptr, 0)) {
+            epoch = RegisterThread();
+        }
+        uint32_t active = epoch->active.load(std::memory_order_relaxed);
+        epoch->active.store(active + 1, std::memory_order_relaxed);
+        if (active != 0) {
+            // 嵌套调用, 外层已经通过检查
+            return;
+        }
+        // 与 BlockAllOperations 中的 fence 配对: 要么写者看到 active != 0,
+        // 要么本线程看到 blocked_ == true.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (__builtin_expect(blocked_.load(std::memory_order_relaxed), 0)) {
+            EnterSlow(epoch);
+        }
+    }
+
+    static inline void Exit() {
+        ThreadEpoch* epoch = CurrentEpoch();
+        uint32_t active = epoch->active.load(std::memory_order_relaxed);
+        epoch->active.store(active - 1, std::memory_order_release);
+    }
+
+    static inline ThreadEpoch* CurrentEpoch() {
+#if DEBUG_USE_PTHREAD_KEY_TLS
+        return static_cast<ThreadEpoch*>(pthread_getspecific(exit_key_));
+#else
+        return tls_epoch_;
+#endif
+    }
+
+    static ThreadEpoch* RegisterThread();
+    static void EnterSlow(ThreadEpoch* epoch);
+    static void ThreadExit(void* data);
+    static void AtForkChild();
+
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+    static DEBUG_TLS ThreadEpoch* tls_epoch_;
+#endif
+
+    static std::atomic<ThreadEpoch*> head_;
+    static std::atomic<bool> blocked_;
+    static std::atomic<ThreadEpoch*> owner_;
+    static pthread_key_t exit_key_;
+    static pthread_mutex_t block_mutex_;
+    static pthread_mutex_t wait_mutex_;
+    static pthread_cond_t wait_cond_;
+
+    BIONIC_DISALLOW_COPY_AND_ASSIGN(ScopedConcurrentLock);
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+#include "InternalAllocator.h"
+
+// 堆栈驻留表. 相同的堆栈只保存一份, 其它地方都用一个递增的小整数编号引用它.
+// 每帧的 pc 和映射编号分别连续存放在按块分配的数组里, 块一旦分配就不再移动,
+// 登记过的堆栈可以不加锁读取. 编号和存储都不回收, 唯一堆栈的数量受调用点数量限制.
+class StackTable {
+public:
+    // 没有堆栈, 或者堆栈未能登记
+    static constexpr uint32_t kNoStack = 0;
+
+    struct Stack {
+        const uintptr_t* frames;
+        const uint32_t* map_ids;
+        size_t num_frames;
+    };
+
+    // 对全部帧计算 64 位哈希. 在回溯的线程上计算一次, 之后随堆栈传递.
+    // 四路独立累加, 编译器可以展开或向量化.
+    static uint64_t Hash(const uintptr_t* frames, size_t num_frames) {
+        constexpr uint64_t kPrime1 = 0x9e3779b185ebca87ULL;
+        constexpr uint64_t kPrime2 = 0xc2b2ae3d27d4eb4fULL;
+        constexpr uint64_t kPrime3 = 0x165667b19e3779f9ULL;
+        uint64_t lanes[4] = {kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1};
+        size_t i = 0;
+        for (; i + 4 <= num_frames; i += 4) {
+            for (size_t lane = 0; lane < 4; lane++) {
+                lanes[lane] = Round(lanes[lane], frames[i + lane]);
+            }
+        }
+        uint64_t hash = Rotl(lanes[0], 1) + Rotl(lanes[1], 7) + Rotl(lanes[2], 12) +
+                        Rotl(lanes[3], 18);
+        for (; i < num_frames; i++) {
+            hash ^= Round(0, frames[i]);
+            hash = Rotl(hash, 27) * kPrime1 + kPrime3;
+        }
+        hash ^= num_frames;
+        // 最终混合, 让每一位都依赖所有输入位
+        hash ^= hash >> 33;
+        hash *= kPrime2;
+        hash ^= hash >> 29;
+        hash *= kPrime3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+    // 返回堆栈的编号, 首次出现时复制到表中. 表满时返回 kNoStack.
+    uint32_t Intern(
+            uint64_t hash, const uintptr_t* frames, const uint32_t* map_ids,
+            size_t num_frames);
+
+    // id 必须是 Intern 返回的有效编号, 调用者需要通过其它同步先看到这个编号
+    Stack Get(uint32_t id) const {
+        const Record& record = record_chunks_[(id - 1) / kRecordChunkSize].load(
+                std::memory_order_acquire)[(id - 1) % kRecordChunkSize];
+        return Stack{record.frames, record.map_ids, record.num_frames};
+    }
+
+    // 已登记的堆栈数量
+    size_t size() const { return num_stacks_.load(std::memory_order_relaxed); }
+
+private:
+    struct Record {
+        uint64_t hash;
+        const uintptr_t* frames;
+        const uint32_t* map_ids;
+        uint32_t num_frames;
+    };
+
+    struct Slot {
+        uint64_t hash;
+        uint32_t id;
+    };
+
+    static constexpr size_t kFrameChunkSize = 64 * 1024;
+    static constexpr size_t kMaxFrameChunks = 1024;
+    static constexpr size_t kRecordChunkSize = 4096;
+    static constexpr size_t kMaxRecordChunks = 4096;
+
+    static inline uint64_t Rotl(uint64_t value, int bits) {
+        return (value << bits) | (value >> (64 - bits));
+    }
+    static inline uint64_t Round(uint64_t acc, uint64_t input) {
+        acc += input * 0xc2b2ae3d27d4eb4fULL;
+        acc = Rotl(acc, 31);
+        return acc * 0x9e3779b185ebca87ULL;
+    }
+
+    bool Equals(
+            const Record& record, uint64_t hash, const uintptr_t* frames,
+            size_t num_frames) const;
+    // 在块数组中为 num_frames 帧预留连续空间
+    bool Reserve(size_t num_frames, uintptr_t** frames, uint32_t** map_ids);
+    void Grow();
+
+    std::mutex mutex_;
+    // 开放寻址的哈希表, 只在持锁的 Intern 中使用, 编号 0 表示空槽
+    InternalVector<Slot> slots_;
+    std::atomic<size_t> num_stacks_{0};
+
+    size_t frame_chunk_count_ = 0;
+    size_t frame_chunk_used_ = kFrameChunkSize;
+    uintptr_t* frame_chunks_[kMaxFrameChunks] = {};
+    uint32_t* map_id_chunks_[kMaxFrameChunks] = {};
+    std::atomic<Record*> record_chunks_[kMaxRecordChunks] = {};
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <memory>
+
+#include <unwindstack/MapInfo.h>
+
+#include "InternalAllocator.h"
+
+// 回溯时每帧只记录调整后的 pc 和所在映射的编号, 函数名等到 dump 时才解析.
+// 映射编号全局唯一, 登记后一直持有 MapInfo, 库被卸载后旧记录仍能解析.
+class Symbolizer {
+public:
+    // 回溯热路径调用, 映射首次出现时才加锁登记. map_info 为空时返回 0.
+    static uint32_t MapId(const std::shared_ptr<unwindstack::MapInfo>& map_info) {
+        if (map_info == nullptr) {
+            return 0;
+        }
+        uint32_t id = map_info->user_id();
+        if (__builtin_expect(id != 0, 1)) {
+            return id;
+        }
+        return RegisterMap(map_info);
+    }
+
+    // 格式化一帧为 "rel_pc 映射名 (函数名+偏移)", 结果按 (pc, 映射) 缓存.
+    // 缓存只增不删, 返回的引用一直有效.
+    static const InternalString& FormatFrame(uintptr_t pc, uint32_t map_id);
+
+private:
+    static uint32_t RegisterMap(const std::shared_ptr<unwindstack::MapInfo>& map_info);
+};
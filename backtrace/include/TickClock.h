@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 分配记录的时间戳. hook 热路径只读一次硬件计数器, 不进内核也不做换算,
+// 记录和排序都用原始计数, 输出时才换算成墙上时间.
+//   arm64: 通用定时器的虚拟计数 cntvct_el0, 各核同步, 频率由 cntfrq_el0 给出
+//   x86:   TSC, 要求恒定频率 (现代 CPU 和虚拟机都满足), 频率对照单调时钟标定
+//   其它:  CLOCK_MONOTONIC 的纳秒数
+class TickClock {
+public:
+    // 读数不早于之前的内存访问, 与内核 vDSO 的做法一致. 汇总线程按时间合并各线程的
+    // 记录, 先释放后被其它线程重新分配的地址, 两条记录的先后不能颠倒.
+    static inline uint64_t Now() {
+#if defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks) : : "memory");
+        return ticks;
+#elif defined(__x86_64__) || defined(__i386__)
+        _mm_lfence();
+        return __rdtsc();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+    }
+
+    // 记录标定起点, 在开始产生时间戳之前调用
+    static void Initialize();
+
+    // 存活指针记录只留 46 位时间: 相对起点的计数右移到微秒量级,
+    // 超出可表示范围的时间停在最大值
+    static constexpr int kCompressedBits = 46;
+    static uint64_t Compress(uint64_t ticks);
+    static uint64_t Expand(uint64_t compressed);
+
+    // 计数到墙上时间的换算关系, 输出前取一次, 之后换算不再读时钟
+    struct WallAnchor {
+        uint64_t ticks;
+        int64_t wall_ns;
+        double ns_per_tick;
+    };
+    static WallAnchor Anchor();
+
+    static void ToWallTime(
+            const WallAnchor& anchor, uint64_t ticks, struct timespec* wall);
+};
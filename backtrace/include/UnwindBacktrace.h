@@ -33,6 +33,24 @@
 
 #include <unwindstack/Unwinder.h>
 
+#include "InternalAllocator.h"
+
+#include <unwindstack/AndroidUnwinder.h>
+
+// 当前进程共用的回溯器, 符号化也通过它读取进程内存
+unwindstack::AndroidLocalUnwinder& LocalUnwinder();
+
+// 开启后 Unwind() 在每个线程缓存上一次的结果, 与上次重合的外层帧直接复用.
+// 在第一次回溯之前调用.
+void EnableUnwindCache();
+
+// 只记录每帧调整后的 pc 和所在映射的编号 (见 Symbolizer), 不解析函数名
 unwindstack::ErrorCode Unwind(
-        std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* info,
+        InternalVector<uintptr_t>* frames, InternalVector<uint32_t>* map_ids,
+        size_t max_frames);
+
+// 帧指针回溯, 仅支持 arm64 和 x86_64, 其它架构等同于 Unwind().
+// 输出的 frames 与 Unwind() 一致, 帧链断开的帧用 DWARF 补齐.
+unwindstack::ErrorCode FramePointerUnwind(
+        InternalVector<uintptr_t>* frames, InternalVector<uint32_t>* map_ids,
         size_t max_frames);
@@ -5,14 +5,42 @@
 
 #include <bionic/reserved_signals.h>
 
+// =============================================================================
+// 线程局部变量统一使用 initial-exec 模型: 访问只是一次相对线程指针的偏移读写,
+// 不经过 __tls_get_addr. LD_PRELOAD 的 so 在进程启动时加载, 可以占用静态 TLS 区,
+// 但静态 TLS 余量有限, hook 内的 TLS 变量都应保持在几个字节或几个指针的大小.
+//
+// bionic 在 API 29 之前不支持 ELF TLS, thread_local 会退化为 emutls, 首次访问时
+// 会调用 malloc 并重入 hook, 此时退回 pthread key 实现.
+// =============================================================================
+#if defined(__ANDROID__) && __ANDROID_API__ < 29
+#define DEBUG_USE_PTHREAD_KEY_TLS 1
+#define DEBUG_TLS                 thread_local
+#else
+#define DEBUG_USE_PTHREAD_KEY_TLS 0
+#define DEBUG_TLS                 __thread __attribute__((tls_model("initial-exec")))
+#endif
+
 // =============================================================================
 // Used to disable the debug allocation calls.
 // =============================================================================
 bool DebugDisableInitialize();
 void DebugDisableFinalize();
 
+#if DEBUG_USE_PTHREAD_KEY_TLS
 bool DebugCallsDisabled();
 void DebugDisableSet(bool disable);
+#else
+extern DEBUG_TLS bool g_debug_calls_disabled;
+
+inline bool DebugCallsDisabled() {
+    return g_debug_calls_disabled;
+}
+
+inline void DebugDisableSet(bool disable) {
+    g_debug_calls_disabled = disable;
+}
+#endif
 
 class ScopedDisableDebugCalls {
 public:
@@ -31,4 +59,4 @@ private:
     bool disabled_;
 
     BIONIC_DISALLOW_COPY_AND_ASSIGN(ScopedDisableDebugCalls);
-};
\ No newline at end of file
+};
@@ -5,7 +5,8 @@
 
 bool debug_initialize(void* init_space[]);
 void debug_finalize();
-void debug_dump_heap(const char* file_name);
+// wait 为 false 时复制快照后立即返回, 由后台线程写文件
+void debug_dump_heap(const char* file_name, bool wait);
 void* debug_malloc(size_t size);
 void debug_free(void* pointer);
 void* debug_realloc(void* pointer, size_t bytes);
@@ -15,4 +16,9 @@ int debug_posix_memalign(void** memptr, size_t alignment, size_t size);
 void* debug_mmap(void* addr, size_t size, int prot, int flags, int fd, off_t offset);
 int debug_munmap(void* addr, size_t size);
 int debug_ioctl(int fd, unsigned int request, void* arg);
-void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset);
\ No newline at end of file
+void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset);
+int debug_close(int fd);
+int debug_dup(int fd);
+int debug_dup2(int old_fd, int new_fd);
+int debug_dup3(int old_fd, int new_fd, int flags);
+int debug_fcntl(int fd, int cmd, void* arg);
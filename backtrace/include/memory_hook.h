@@ -1,5 +1,9 @@
 #pragma once
+#include <fcntl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <unistd.h>
+#include <atomic>
 #include <cstddef>
 
 extern void* (*m_sys_malloc)(size_t);
@@ -7,4 +11,90 @@ extern void (*m_sys_free)(void*);
 extern void* (*m_sys_calloc)(size_t, size_t);
 extern void* (*m_sys_realloc)(void*, size_t);
 extern void* (*m_sys_memalign)(size_t, size_t);
-extern int (*m_sys_posix_memalign)(void**, size_t, size_t);
\ No newline at end of file
+extern int (*m_sys_posix_memalign)(void**, size_t, size_t);
+
+extern int (*m_sys_close)(int);
+extern int (*m_sys_dup)(int);
+extern int (*m_sys_dup2)(int, int);
+extern int (*m_sys_dup3)(int, int, int);
+extern int (*m_sys_fcntl)(int, int, ...);
+
+// 上面的系统函数表只解析一次, 全部填好后才把状态发布为 kSysAllocatorReady
+enum SysAllocatorState {
+    kSysAllocatorUnresolved,
+    kSysAllocatorResolving,
+    kSysAllocatorReady
+};
+extern std::atomic<int> g_sys_allocator_state;
+
+inline bool SysAllocatorReady() {
+    return g_sys_allocator_state.load(std::memory_order_acquire) == kSysAllocatorReady;
+}
+
+// 解析系统函数. 返回 false 表示解析正在进行 (例如 dlsym 内部又调用了 malloc),
+// 调用者应改用 bootstrap arena.
+bool ResolveSysAllocator();
+
+// 系统函数表在加载时解析一次, 之后 hook 入口只需检查一次发布状态.
+// 返回 false 表示解析仍在进行中 (dlsym 自身在申请内存), 此时应使用 bootstrap arena.
+inline bool EnsureSysAllocator() {
+    return __builtin_expect(SysAllocatorReady(), 1) || ResolveSysAllocator();
+}
+
+// dlsym 解析期间的内存由一块静态 arena 提供, 这些指针永远不会交给系统 free.
+void* BootstrapMalloc(size_t size);
+void* BootstrapCalloc(size_t nmemb, size_t size);
+// 非 bootstrap 的指针会等待解析完成后交给系统 realloc
+void* BootstrapRealloc(void* ptr, size_t size);
+bool IsBootstrapPointer(const void* ptr);
+
+// fd 相关 hook 转发给 libc 的实现, 保留 bionic fdsan 对 owner tag 的维护、close 的
+// EINTR 语义、glibc 的取消点以及 32 位 struct flock 的转换.
+// 只有系统函数表还在解析时才直接发起系统调用.
+inline int SysClose(int fd) {
+    if (__builtin_expect(EnsureSysAllocator(), 1)) {
+        return m_sys_close(fd);
+    }
+    return (int)syscall(SYS_close, fd);
+}
+
+inline int SysDup(int fd) {
+    if (__builtin_expect(EnsureSysAllocator(), 1)) {
+        return m_sys_dup(fd);
+    }
+    return (int)syscall(SYS_dup, fd);
+}
+
+inline int SysDup2(int old_fd, int new_fd) {
+    if (__builtin_expect(EnsureSysAllocator(), 1)) {
+        return m_sys_dup2(old_fd, new_fd);
+    }
+    // arm64 等新架构没有 dup2
+#if defined(SYS_dup2)
+    return (int)syscall(SYS_dup2, old_fd, new_fd);
+#else
+    if (old_fd == new_fd) {
+        // dup3 不接受相同的 fd, dup2 此时只检查 fd 是否有效
+        return (int)syscall(SYS_fcntl, old_fd, F_GETFD) == -1 ? -1 : new_fd;
+    }
+    return (int)syscall(SYS_dup3, old_fd, new_fd, 0);
+#endif
+}
+
+inline int SysDup3(int old_fd, int new_fd, int flags) {
+    if (__builtin_expect(EnsureSysAllocator(), 1)) {
+        return m_sys_dup3(old_fd, new_fd, flags);
+    }
+    return (int)syscall(SYS_dup3, old_fd, new_fd, flags);
+}
+
+inline int SysFcntl(int fd, int cmd, void* arg) {
+    if (__builtin_expect(EnsureSysAllocator(), 1)) {
+        return m_sys_fcntl(fd, cmd, arg);
+    }
+#if defined(SYS_fcntl64)
+    return (int)syscall(SYS_fcntl64, fd, cmd, arg);
+#else
+    return (int)syscall(SYS_fcntl, fd, cmd, arg);
+#endif
+}
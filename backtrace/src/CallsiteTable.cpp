@@ -0,0 +1,89 @@
+#include "CallsiteTable.h"
+
+void CallsiteTable::Clear() {
+    index_.clear();
+    entries_.clear();
+    free_.clear();
+    changed_.clear();
+}
+
+void CallsiteTable::Add(const CallsiteKey& key, uint64_t ticks) {
+    uint32_t index;
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        index = it->second;
+    } else if (!free_.empty()) {
+        index = free_.back();
+        free_.pop_back();
+        entries_[index] = CallsiteInfo{key, 0, ticks, ticks, kNotChanged, false};
+        index_.emplace(key, index);
+    } else {
+        index = static_cast<uint32_t>(entries_.size());
+        entries_.push_back(CallsiteInfo{key, 0, ticks, ticks, kNotChanged, false});
+        index_.emplace(key, index);
+    }
+
+    CallsiteInfo& info = entries_[index];
+    if (info.count++ == 0) {
+        info.first_ticks = ticks;
+    }
+    info.last_ticks = ticks;
+    MarkChanged(index);
+}
+
+void CallsiteTable::Remove(const CallsiteKey& key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return;
+    }
+    uint32_t index = it->second;
+    CallsiteInfo& info = entries_[index];
+    if (--info.count != 0 || info.reported) {
+        // 交出过的条目归零后也要等下次交出, 使用者才能删掉它
+        MarkChanged(index);
+        return;
+    }
+    // 使用者从未见过这个条目, 不必再交出
+    UnmarkChanged(index);
+    Release(index);
+}
+
+void CallsiteTable::TakeChanges(const std::function<void(const CallsiteInfo&)>& func) {
+    for (uint32_t index : changed_) {
+        CallsiteInfo& info = entries_[index];
+        info.changed_pos = kNotChanged;
+        func(info);
+        if (info.count == 0) {
+            Release(index);
+        } else {
+            info.reported = true;
+        }
+    }
+    changed_.clear();
+}
+
+void CallsiteTable::MarkChanged(uint32_t index) {
+    CallsiteInfo& info = entries_[index];
+    if (track_changes_ && info.changed_pos == kNotChanged) {
+        info.changed_pos = static_cast<uint32_t>(changed_.size());
+        changed_.push_back(index);
+    }
+}
+
+void CallsiteTable::UnmarkChanged(uint32_t index) {
+    uint32_t pos = entries_[index].changed_pos;
+    if (pos == kNotChanged) {
+        return;
+    }
+    // 变化记录无序, 用最后一项填补空位
+    uint32_t last = changed_.back();
+    changed_[pos] = last;
+    entries_[last].changed_pos = pos;
+    changed_.pop_back();
+    entries_[index].changed_pos = kNotChanged;
+}
+
+void CallsiteTable::Release(uint32_t index) {
+    index_.erase(entries_[index].key);
+    free_.push_back(index);
+}
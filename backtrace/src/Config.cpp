@@ -67,6 +67,33 @@ bool Config::Init() {
         backtrace_dump_on_exit_ = true;
     }
 
+    // 按平均间隔 (字节) 泊松采样, 只有被采中的 host 分配才 unwind 和记录,
+    // dump 中输出按采样概率放大后的估计值
+    if (ParseValue(getenv("SAMPLE_INTERVAL_BYTES"), &sample_interval_bytes_) &&
+        sample_interval_bytes_ > 0) {
+        options_ |= SAMPLE_ALLOCS;
+    }
+
+    // 记录队列满时默认阻塞等待汇总线程, 设置后改为丢弃分配记录并计数
+    if (getenv("DROP_EVENTS_ON_FULL") != nullptr) {
+        options_ |= DROP_EVENTS_ON_FULL;
+    }
+
+    // 按帧指针回溯代替 DWARF 回溯, 要求被测库使用 -fno-omit-frame-pointer 编译
+    if (getenv("FP_UNWIND") != nullptr) {
+        options_ |= FRAME_POINTER_UNWIND;
+    }
+
+    // 缓存每个线程上一次 DWARF 回溯的结果, 深调用链中反复分配时只回溯变化的内层帧
+    if (getenv("UNWIND_CACHE") != nullptr) {
+        options_ |= UNWIND_CACHE;
+    }
+
+    // dump 默认按调用点汇总输出, 设置后改为逐个存活指针按分配时间输出
+    if (getenv("DUMP_POINTERS") != nullptr) {
+        options_ |= DUMP_POINTER_LIST;
+    }
+
     // 通过信号插入 check point
     options_ |= DUMP_ON_SINGAL;
     backtrace_dump_signal_ = BIONIC_SIGNAL_BACKTRACE;  // BIONIC_SIGNAL_BACKTRACE: 33
@@ -9,6 +9,8 @@ bool DebugData::Initialize(void* storage) {
     if (!pointer->Initialize(config_)) {
         return false;
     }
+    dma_bufs.Initialize(TrackPointers() ? pointer.get() : nullptr);
+    gpu_handles.Initialize(TrackPointers() ? pointer.get() : nullptr);
 
     return true;
 }
\ No newline at end of file
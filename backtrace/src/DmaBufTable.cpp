@@ -0,0 +1,253 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "DmaBufTable.h"
+#include "PointerData.h"
+
+namespace {
+
+// fdinfo 一般只有几行, dma-buf 的也不超过这个长度
+constexpr size_t kFdInfoMaxBytes = 1024;
+
+// 读取 /proc/self/fdinfo/<fd>, 不是 dma-buf 时返回 false
+bool ReadFdInfo(int fd, DmaBuf* info) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+    int info_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (info_fd == -1) {
+        return false;
+    }
+    char buffer[kFdInfoMaxBytes];
+    size_t length = 0;
+    while (length < sizeof(buffer) - 1) {
+        ssize_t count = read(info_fd, buffer + length, sizeof(buffer) - 1 - length);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        length += count;
+    }
+    close(info_fd);
+    buffer[length] = '\0';
+
+    bool found = false;
+    info->size = 0;
+    for (char* line = buffer; line != nullptr && *line != '\0';) {
+        char* next = strchr(line, '\n');
+        if (next != nullptr) {
+            *next++ = '\0';
+        }
+        if (strncmp(line, "size:", 5) == 0) {
+            info->size = strtoull(line + 5, nullptr, 10);
+        } else if (strncmp(line, "exp_name:", 9) == 0) {
+            const char* name = line + 9;
+            name += strspn(name, " \t");
+            snprintf(info->exp_name, sizeof(info->exp_name), "%s", name);
+            found = true;
+        }
+        line = next;
+    }
+    return found;
+}
+
+}  // namespace
+
+std::atomic<uint64_t> DmaBufTable::fd_bits_[kFdBitmapBits / 64];
+std::atomic<size_t> DmaBufTable::high_fds_;
+
+void DmaBufTable::SetFdBit(int fd, bool set) {
+    if (static_cast<size_t>(fd) >= kFdBitmapBits) {
+        if (set) {
+            high_fds_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            high_fds_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    uint64_t bit = uint64_t{1} << (fd % 64);
+    if (set) {
+        fd_bits_[fd / 64].fetch_or(bit, std::memory_order_relaxed);
+    } else {
+        fd_bits_[fd / 64].fetch_and(~bit, std::memory_order_relaxed);
+    }
+}
+
+bool DmaBufTable::IsDmaBufDevice(dev_t dev) {
+    if (dma_buf_dev_known_) {
+        return dev == dma_buf_dev_;
+    }
+    return std::find(other_devs_.begin(), other_devs_.end(), dev) == other_devs_.end();
+}
+
+DmaBuf* DmaBufTable::FindOrCreate(
+        int fd, dev_t dev, uint64_t inode, bool exported, size_t size, bool account) {
+    auto it = buffers_.find(inode);
+    if (it != buffers_.end()) {
+        return it->second;
+    }
+
+    // 新的 buffer, 或者还没确认过的设备上的文件.
+    // 早期内核的 fdinfo 没有 exp_name, 由分配 ioctl 得到的 fd 不需要它来确认.
+    DmaBuf info = {};
+    if (!ReadFdInfo(fd, &info) && !exported) {
+        if (!dma_buf_dev_known_) {
+            other_devs_.push_back(dev);
+        }
+        return nullptr;
+    }
+    dma_buf_dev_known_ = true;
+    dma_buf_dev_ = dev;
+
+    if (size != 0) {
+        info.size = size;
+    } else if (info.size == 0) {
+        // dma-buf 支持用 SEEK_END 查询大小, 文件位置对它没有意义
+        off_t end = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        info.size = end > 0 ? static_cast<size_t>(end) : 0;
+    }
+
+    DmaBuf* buffer = new (InternalArena::Allocate(sizeof(DmaBuf))) DmaBuf(info);
+    buffer->inode = inode;
+    buffer->fd_refs = 0;
+    buffer->map_refs = 0;
+    buffer->accounted = account;
+    buffers_.emplace(inode, buffer);
+    if (pointer_ != nullptr && account) {
+        pointer_->Add(buffer, buffer->size, DMA);
+    }
+    return buffer;
+}
+
+void DmaBufTable::BindFd(int fd, DmaBuf* buffer) {
+    auto result = fds_.emplace(fd, buffer);
+    buffer->fd_refs++;
+    if (result.second) {
+        SetFdBit(fd, true);
+        return;
+    }
+    // fd 之前引用的 buffer 没有经过 hook 关闭, 例如 close_range
+    DmaBuf* old_buffer = result.first->second;
+    result.first->second = buffer;
+    old_buffer->fd_refs--;
+    ReleaseIfUnused(old_buffer);
+}
+
+void DmaBufTable::UnbindFd(int fd) {
+    auto it = fds_.find(fd);
+    if (it == fds_.end()) {
+        return;
+    }
+    DmaBuf* buffer = it->second;
+    fds_.erase(it);
+    SetFdBit(fd, false);
+    buffer->fd_refs--;
+    ReleaseIfUnused(buffer);
+}
+
+void DmaBufTable::ReleaseIfUnused(DmaBuf* buffer) {
+    if (buffer->fd_refs != 0 || buffer->map_refs != 0) {
+        return;
+    }
+    buffers_.erase(buffer->inode);
+    // 先删除记录再释放对象, 对象地址被新的 buffer 复用时记录的先后不会颠倒
+    if (pointer_ != nullptr && buffer->accounted) {
+        pointer_->Remove(buffer);
+    }
+    InternalArena::Free(buffer, sizeof(DmaBuf));
+}
+
+bool DmaBufTable::Map(int fd, const void* addr) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    DmaBuf* buffer = nullptr;
+    if (MaybeDmaBufFd(fd)) {
+        auto it = fds_.find(fd);
+        if (it != fds_.end()) {
+            buffer = it->second;
+        }
+    }
+    if (buffer == nullptr) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !IsDmaBufDevice(st.st_dev)) {
+            return false;
+        }
+        buffer = FindOrCreate(fd, st.st_dev, st.st_ino, false, 0, true);
+        if (buffer == nullptr) {
+            return false;
+        }
+        // 第一次见到这个 fd (例如从其它进程收到), 从现在起跟踪它的生命周期
+        BindFd(fd, buffer);
+    }
+
+    auto result = mappings_.emplace(reinterpret_cast<uintptr_t>(addr), buffer);
+    buffer->map_refs++;
+    if (result.second) {
+        mapping_count_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    // 同一地址上的旧映射没有经过 munmap 解除, 例如被 MAP_FIXED 覆盖
+    DmaBuf* old_buffer = result.first->second;
+    result.first->second = buffer;
+    old_buffer->map_refs--;
+    ReleaseIfUnused(old_buffer);
+    return true;
+}
+
+void DmaBufTable::AddExported(int fd, size_t size, bool account) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (dma_buf_dev_known_ && st.st_dev != dma_buf_dev_) {
+        return;
+    }
+    DmaBuf* buffer = FindOrCreate(fd, st.st_dev, st.st_ino, true, size, account);
+    if (buffer != nullptr) {
+        BindFd(fd, buffer);
+    }
+}
+
+void DmaBufTable::Unmap(const void* addr) {
+    // 大多数 munmap 与 dma-buf 无关
+    if (mapping_count_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = mappings_.find(reinterpret_cast<uintptr_t>(addr));
+    if (it == mappings_.end()) {
+        return;
+    }
+    DmaBuf* buffer = it->second;
+    mappings_.erase(it);
+    mapping_count_.fetch_sub(1, std::memory_order_relaxed);
+    buffer->map_refs--;
+    ReleaseIfUnused(buffer);
+}
+
+void DmaBufTable::CloseFd(int fd) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    UnbindFd(fd);
+}
+
+void DmaBufTable::DupFd(int old_fd, int new_fd) {
+    if (old_fd == new_fd) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    UnbindFd(new_fd);
+    auto it = fds_.find(old_fd);
+    if (it != fds_.end()) {
+        BindFd(new_fd, it->second);
+    }
+}
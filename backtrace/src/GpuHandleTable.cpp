@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <new>
+
+#include "DmaBufTable.h"
+#include "GpuHandleTable.h"
+
+void GpuHandleTable::Add(const GpuHandleKey& key, size_t size, MemType type) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    // 同一句柄再次出现说明之前的释放没有被看到, 例如设备 fd 被关闭
+    auto it = handles_.find(key);
+    if (it != handles_.end()) {
+        Release(it->second);
+    }
+
+    GpuAllocation* allocation = new (InternalArena::Allocate(sizeof(GpuAllocation)))
+            GpuAllocation{key, size, 0};
+    handles_.emplace(key, allocation);
+    if (std::find(device_fds_.begin(), device_fds_.end(), key.fd) ==
+        device_fds_.end()) {
+        device_fds_.push_back(key.fd);
+        DmaBufTable::SetFdBit(key.fd, true);
+    }
+    if (key.driver == kMaliDriver && key.handle >= kMaliCookieBase &&
+        key.handle < kMaliCookieEnd) {
+        pending_cookies_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (pointer_ != nullptr) {
+        pointer_->Add(allocation, size, type);
+    }
+}
+
+void GpuHandleTable::Remove(const GpuHandleKey& key) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = handles_.find(key);
+    if (it != handles_.end()) {
+        Release(it->second);
+    }
+}
+
+bool GpuHandleTable::Contains(const GpuHandleKey& key) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return handles_.count(key) != 0;
+}
+
+void GpuHandleTable::MapCookie(int fd, uint64_t offset, const void* addr) {
+    if (pending_cookies_.load(std::memory_order_relaxed) == 0 ||
+        offset < kMaliCookieBase || offset >= kMaliCookieEnd) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = handles_.find(GpuHandleKey{fd, kMaliDriver, offset});
+    if (it == handles_.end()) {
+        return;
+    }
+    // same-VA 分配的 GPU 地址与 CPU 地址相同, 之后按这个地址释放
+    GpuAllocation* allocation = it->second;
+    handles_.erase(it);
+    pending_cookies_.fetch_sub(1, std::memory_order_relaxed);
+    uintptr_t address = reinterpret_cast<uintptr_t>(addr);
+    allocation->key.handle = address;
+    allocation->free_on_unmap = address;
+    handles_.emplace(allocation->key, allocation);
+    unmap_frees_.emplace(address, allocation);
+    unmap_free_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void GpuHandleTable::Unmap(const void* addr) {
+    if (unmap_free_count_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = unmap_frees_.find(reinterpret_cast<uintptr_t>(addr));
+    if (it != unmap_frees_.end()) {
+        Release(it->second);
+    }
+}
+
+void GpuHandleTable::CloseFd(int fd) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto device = std::find(device_fds_.begin(), device_fds_.end(), fd);
+    if (device == device_fds_.end()) {
+        return;
+    }
+    *device = device_fds_.back();
+    device_fds_.pop_back();
+    DmaBufTable::SetFdBit(fd, false);
+
+    // 关闭设备 fd 很少见, 遍历整张表即可
+    InternalVector<GpuAllocation*> closed;
+    for (const auto& entry : handles_) {
+        if (entry.first.fd == fd && entry.second->free_on_unmap == 0) {
+            closed.push_back(entry.second);
+        }
+    }
+    for (GpuAllocation* allocation : closed) {
+        Release(allocation);
+    }
+}
+
+void GpuHandleTable::Release(GpuAllocation* allocation) {
+    const GpuHandleKey& key = allocation->key;
+    handles_.erase(key);
+    if (allocation->free_on_unmap != 0) {
+        unmap_frees_.erase(allocation->free_on_unmap);
+        unmap_free_count_.fetch_sub(1, std::memory_order_relaxed);
+    } else if (
+            key.driver == kMaliDriver && key.handle >= kMaliCookieBase &&
+            key.handle < kMaliCookieEnd) {
+        pending_cookies_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // GpuAllocation 的地址就是指针记录的键. Add 遇到驱动复用的句柄时, 释放旧对象后
+    // 马上分配的新对象可能落在同一地址, 所以 Remove 必须在 Free 之前进入事件流
+    if (pointer_ != nullptr) {
+        pointer_->Remove(allocation);
+    }
+    InternalArena::Free(allocation, sizeof(GpuAllocation));
+}
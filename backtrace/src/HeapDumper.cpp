@@ -0,0 +1,141 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "DebugData.h"
+#include "HeapDumper.h"
+#include "debug_disable.h"
+
+extern DebugData* g_debug;
+
+namespace {
+
+struct DumpJob {
+    InternalString file_name;
+    DumpSnapshot* snapshot;
+    // 有线程在等待时由等待者释放, 否则由 dump 线程释放
+    bool waited;
+    bool done;
+};
+
+pthread_mutex_t g_dumper_mutex = PTHREAD_MUTEX_INITIALIZER;
+// 有新任务, 以及有任务完成
+pthread_cond_t g_job_cond = PTHREAD_COND_INITIALIZER;
+pthread_cond_t g_done_cond = PTHREAD_COND_INITIALIZER;
+bool g_dumper_started = false;
+// 排队和正在写的任务数
+size_t g_pending_jobs = 0;
+
+// 可能早于静态构造使用, 也不能在退出时析构
+InternalVector<DumpJob*>& JobQueue() {
+    [[clang::no_destroy]] static InternalVector<DumpJob*> queue;
+    return queue;
+}
+
+void FreeJob(DumpJob* job) {
+    job->~DumpJob();
+    InternalArena::Free(job, sizeof(DumpJob));
+}
+
+void* DumperMain(void*) {
+    // 符号化和格式化时的内存申请不能再被记录
+    DebugDisableSet(true);
+
+    pthread_mutex_lock(&g_dumper_mutex);
+    while (true) {
+        while (JobQueue().empty()) {
+            pthread_cond_wait(&g_job_cond, &g_dumper_mutex);
+        }
+        DumpJob* job = JobQueue().front();
+        JobQueue().erase(JobQueue().begin());
+        pthread_mutex_unlock(&g_dumper_mutex);
+
+        HeapDumper::Write(job->file_name.c_str(), job->snapshot);
+
+        pthread_mutex_lock(&g_dumper_mutex);
+        g_pending_jobs--;
+        if (job->waited) {
+            job->done = true;
+        } else {
+            FreeJob(job);
+        }
+        pthread_cond_broadcast(&g_done_cond);
+    }
+    return nullptr;
+}
+
+// 调用者持有 g_dumper_mutex
+bool StartDumperLocked() {
+    if (g_dumper_started) {
+        return true;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    g_dumper_started = pthread_create(&thread, &attr, DumperMain, nullptr) == 0;
+    pthread_attr_destroy(&attr);
+    return g_dumper_started;
+}
+
+}  // namespace
+
+void HeapDumper::Initialize() {
+    pthread_atfork(
+            [] { pthread_mutex_lock(&g_dumper_mutex); },
+            [] { pthread_mutex_unlock(&g_dumper_mutex); },
+            [] {
+                // 子进程中没有 dump 线程, 父进程排队的任务也不属于子进程
+                g_dumper_started = false;
+                g_pending_jobs = 0;
+                JobQueue().clear();
+                pthread_mutex_unlock(&g_dumper_mutex);
+            });
+}
+
+DumpSnapshot* HeapDumper::NewSnapshot() {
+    return new (InternalArena::Allocate(sizeof(DumpSnapshot))) DumpSnapshot();
+}
+
+void HeapDumper::Write(const char* file_name, DumpSnapshot* snapshot) {
+    int fd = open(file_name, O_RDWR | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd != -1) {
+        g_debug->pointer->WriteSnapshot(fd, snapshot);
+        close(fd);
+    }
+    snapshot->~DumpSnapshot();
+    InternalArena::Free(snapshot, sizeof(DumpSnapshot));
+}
+
+void HeapDumper::Submit(const char* file_name, DumpSnapshot* snapshot, bool wait) {
+    pthread_mutex_lock(&g_dumper_mutex);
+    if (!StartDumperLocked()) {
+        pthread_mutex_unlock(&g_dumper_mutex);
+        Write(file_name, snapshot);
+        return;
+    }
+
+    DumpJob* job = new (InternalArena::Allocate(sizeof(DumpJob)))
+            DumpJob{InternalString(file_name), snapshot, wait, false};
+    JobQueue().push_back(job);
+    g_pending_jobs++;
+    pthread_cond_signal(&g_job_cond);
+
+    if (wait) {
+        while (!job->done) {
+            pthread_cond_wait(&g_done_cond, &g_dumper_mutex);
+        }
+        FreeJob(job);
+    }
+    pthread_mutex_unlock(&g_dumper_mutex);
+}
+
+void HeapDumper::Flush() {
+    pthread_mutex_lock(&g_dumper_mutex);
+    while (g_pending_jobs != 0) {
+        pthread_cond_wait(&g_done_cond, &g_dumper_mutex);
+    }
+    pthread_mutex_unlock(&g_dumper_mutex);
+}
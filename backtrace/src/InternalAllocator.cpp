@@ -0,0 +1,138 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <mutex>
+
+#include "InternalAllocator.h"
+
+// 小于等于 256 字节按 16 字节递增分级, 之后按 2 的幂分级到 32KB, 更大的直接 mmap
+static constexpr size_t kSmallClassStep = 16;
+static constexpr size_t kSmallClassMax = 256;
+static constexpr size_t kLargeClassMax = 32 * 1024;
+static constexpr size_t kNumSmallClasses = kSmallClassMax / kSmallClassStep;
+static constexpr size_t kNumClasses = kNumSmallClasses + 7;  // 512 ... 32KB
+static constexpr size_t kSpanSize = 64 * 1024;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+struct SizeClass {
+    std::mutex mutex;
+    FreeBlock* free_list = nullptr;
+    // 当前 span 中尚未切分的区域
+    char* bump = nullptr;
+    char* bump_end = nullptr;
+};
+
+static SizeClass g_classes[kNumClasses];
+
+std::atomic<size_t> InternalArena::mapped_bytes_{0};
+std::atomic<size_t> InternalArena::used_bytes_{0};
+
+static inline size_t ClassIndex(size_t bytes) {
+    if (bytes <= kSmallClassMax) {
+        return bytes == 0 ? 0 : (bytes - 1) / kSmallClassStep;
+    }
+    // 257..512 -> kNumSmallClasses, 513..1024 -> +1, ...
+    size_t log2 = 64 - __builtin_clzll(static_cast<unsigned long long>(bytes - 1));
+    return kNumSmallClasses + log2 - 9;
+}
+
+static inline size_t ClassSize(size_t index) {
+    if (index < kNumSmallClasses) {
+        return (index + 1) * kSmallClassStep;
+    }
+    return static_cast<size_t>(512) << (index - kNumSmallClasses);
+}
+
+static inline size_t PageRound(size_t bytes) {
+    size_t page_size = getpagesize();
+    return (bytes + page_size - 1) & ~(page_size - 1);
+}
+
+void* InternalArena::MapPages(size_t bytes) {
+    // 直接走系统调用, 避免进入被 hook 的 mmap
+    void* addr = reinterpret_cast<void*>(
+            syscall(SYS_mmap, nullptr, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (addr == MAP_FAILED) {
+        return nullptr;
+    }
+    mapped_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    return addr;
+}
+
+void* InternalArena::RemapPages(void* addr, size_t old_bytes, size_t new_bytes) {
+    void* new_addr = reinterpret_cast<void*>(
+            syscall(SYS_mremap, addr, old_bytes, new_bytes, MREMAP_MAYMOVE));
+    if (new_addr == MAP_FAILED) {
+        return nullptr;
+    }
+    mapped_bytes_.fetch_add(new_bytes - old_bytes, std::memory_order_relaxed);
+    return new_addr;
+}
+
+void InternalArena::UnmapPages(void* addr, size_t bytes) {
+    syscall(SYS_munmap, addr, bytes);
+    mapped_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void* InternalArena::Allocate(size_t bytes) {
+    void* result;
+    if (bytes > kLargeClassMax) {
+        size_t map_bytes = PageRound(bytes);
+        result = MapPages(map_bytes);
+        if (result != nullptr) {
+            used_bytes_.fetch_add(map_bytes, std::memory_order_relaxed);
+        }
+    } else {
+        size_t index = ClassIndex(bytes);
+        size_t class_size = ClassSize(index);
+        SizeClass& size_class = g_classes[index];
+        std::lock_guard<std::mutex> guard(size_class.mutex);
+        if (size_class.free_list != nullptr) {
+            result = size_class.free_list;
+            size_class.free_list = size_class.free_list->next;
+        } else {
+            if (size_class.bump + class_size > size_class.bump_end) {
+                // span 尾部不足一个块的部分直接丢弃
+                char* span = static_cast<char*>(MapPages(kSpanSize));
+                if (span == nullptr) {
+                    abort();
+                }
+                size_class.bump = span;
+                size_class.bump_end = span + kSpanSize;
+            }
+            result = size_class.bump;
+            size_class.bump += class_size;
+        }
+        used_bytes_.fetch_add(class_size, std::memory_order_relaxed);
+    }
+    // STL 容器无法处理返回空指针, 工具内存耗尽时直接终止
+    if (result == nullptr) {
+        abort();
+    }
+    return result;
+}
+
+void InternalArena::Free(void* ptr, size_t bytes) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (bytes > kLargeClassMax) {
+        size_t map_bytes = PageRound(bytes);
+        used_bytes_.fetch_sub(map_bytes, std::memory_order_relaxed);
+        UnmapPages(ptr, map_bytes);
+        return;
+    }
+    size_t index = ClassIndex(bytes);
+    SizeClass& size_class = g_classes[index];
+    std::lock_guard<std::mutex> guard(size_class.mutex);
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = size_class.free_list;
+    size_class.free_list = block;
+    used_bytes_.fetch_sub(ClassSize(index), std::memory_order_relaxed);
+}
@@ -1,7 +1,13 @@
-#include <cxxabi.h>
 #include <inttypes.h>
-#include <sys/time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -11,14 +17,15 @@
 #include "Config.h"
 #include "DebugData.h"
 #include "PointerData.h"
+#include "ScopedConcurrentLock.h"
+#include "Symbolizer.h"
+#include "TickClock.h"
 #include "UnwindBacktrace.h"
+#include "debug_disable.h"
 
-#include "android-base/stringprintf.h"
 #include "unwindstack/Error.h"
 
-constexpr size_t kBacktraceExitIndex = 0;
-constexpr size_t kBacktraceEmptyIndex = 1;
-const char* mtype[3] = {"host", "mmap", "dma"};
+const char* mtype[4] = {"host", "mmap", "dma", "gpu"};
 
 static inline bool ShouldBacktraceAllocSize(size_t size_bytes) {
     static bool only_backtrace_specific_sizes =
@@ -32,312 +39,839 @@ static inline bool ShouldBacktraceAllocSize(size_t size_bytes) {
     return size_bytes >= min_size_bytes && size_bytes <= max_size_bytes;
 }
 
+static inline bool UpdatePeak(std::atomic<size_t>* peak, size_t value) {
+    if (value <= peak->load(std::memory_order_relaxed)) {
+        return false;
+    }
+    peak->store(value, std::memory_order_relaxed);
+    return true;
+}
+
+// 线程队列的注册表, 记录只增不减, 线程退出后复用
+static std::atomic<ThreadEventRing*> g_ring_head{nullptr};
+static pthread_key_t g_ring_key;
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+static DEBUG_TLS ThreadEventRing* g_thread_ring = nullptr;
+#endif
+
+// 汇总线程. 队列过半时由生产者唤醒, 否则定期醒来消费
+static constexpr long kAggregatorPeriodNs = 2 * 1000 * 1000;
+static pthread_mutex_t g_aggregator_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_aggregator_cond = PTHREAD_COND_INITIALIZER;
+static std::atomic<bool> g_aggregator_started{false};
+static std::atomic<bool> g_aggregator_stop{false};
+
 bool PointerData::Initialize(const Config& config) {
-    pointers_.clear();
-    key_to_index_.clear();
-    frames_.clear();
-    backtraces_info_.clear();
-    peak_list.clear();
-    // A hash index of kBacktraceEmptyIndex indicates that we tried to get
-    // a backtrace, but there was nothing recorded.
-    cur_hash_index_ = kBacktraceEmptyIndex + 1;
-    current_used = current_host = current_dma = 0;
-    peak_tot = peak_host = peak_dma = 0;
+    for (auto& shard : pointer_shards_) {
+        shard.pointers.Clear();
+    }
+    callsites_.Clear();
+    callsites_.TrackChanges(config.options() & RECORD_MEMORY_PEAK);
+    peak_callsites_.clear();
+    current_used = current_host = current_dma = current_gpu = 0;
+    peak_tot = peak_host = peak_dma = peak_gpu = 0;
+    peak_list_used_ = 0;
+    peak_pending_ = false;
+    dropped_events_ = dropped_bytes_ = 0;
+    sample_interval_ =
+            (config.options() & SAMPLE_ALLOCS) ? config.sample_interval_bytes() : 0;
+
+    if (config.options() & UNWIND_CACHE) {
+        EnableUnwindCache();
+    }
+    TickClock::Initialize();
 
+    pthread_key_create(&g_ring_key, RingThreadExit);
+    // fork 时不能有线程正在消费, 子进程中汇总线程不复存在, 下次记录时重新启动
+    pthread_atfork(
+            [] { g_debug->pointer->drain_mutex_.lock(); },
+            [] { g_debug->pointer->drain_mutex_.unlock(); }, AtForkChild);
     return true;
 }
 
-void PointerData::Add(const void* ptr, size_t pointer_size, MemType type) {
-    size_t hash_index = 0;
-    hash_index = AddBacktrace(g_debug->config().backtrace_frames(), pointer_size);
+static inline ThreadEventRing* ThreadRing() {
+#if DEBUG_USE_PTHREAD_KEY_TLS
+    return static_cast<ThreadEventRing*>(pthread_getspecific(g_ring_key));
+#else
+    return g_thread_ring;
+#endif
+}
 
-    // unwind 跳过的函数，不记录其堆栈和 pointer 信息
-    if (hash_index == kBacktraceExitIndex)
-        return;
+void PointerData::AtForkChild() {
+    // 子进程只剩当前线程, 其余线程的队列不会再退出, 直接回收. 队列里 fork 前的
+    // 记录仍然有效, 由重新启动的汇总线程照常消费
+    ThreadEventRing* self = ThreadRing();
+    for (ThreadEventRing* it = g_ring_head.load(std::memory_order_relaxed);
+         it != nullptr; it = it->next) {
+        if (it != self) {
+            it->in_use.store(false, std::memory_order_relaxed);
+        }
+    }
+    g_aggregator_started.store(false, std::memory_order_relaxed);
+    g_debug->pointer->drain_mutex_.unlock();
+}
 
-    std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    uintptr_t mangled_ptr = ManglePointer(reinterpret_cast<uintptr_t>(ptr));
-    pointers_[mangled_ptr] = PointerInfoType{pointer_size, hash_index, type, tv};
-    current_used += pointer_size;
-    size_t* current = (type == DMA) ? &current_dma : &current_host;
-    size_t* peak = (type == DMA) ? &peak_dma : &peak_host;
-    *current += pointer_size;
-    if (*current > *peak) {
-        *peak = *current;
-    }
-    if (peak_tot < current_used) {
-        peak_tot = current_used;
-
-        if ((g_debug->config().options() & RECORD_MEMORY_PEAK) &&
-            peak_tot > g_debug->config().backtrace_dump_peak_val()) {
-            std::lock_guard<std::mutex> frame_guard(frame_mutex_);
-            peak_list.clear();
-            GetUniqueList(&peak_list, true);
+ThreadEventRing* PointerData::CurrentRing() {
+    // fork 出的子进程中, 已有队列的线程也要在这里重新启动汇总线程
+    if (__builtin_expect(!g_aggregator_started.load(std::memory_order_relaxed), 0)) {
+        StartAggregator();
+    }
+    ThreadEventRing* ring = ThreadRing();
+    if (__builtin_expect(ring == nullptr, 0)) {
+        ring = RegisterRing();
+    }
+    return ring;
+}
+
+ThreadEventRing* PointerData::RegisterRing() {
+    ThreadEventRing* ring = nullptr;
+    for (ThreadEventRing* it = g_ring_head.load(std::memory_order_acquire);
+         it != nullptr; it = it->next) {
+        bool expected = false;
+        if (!it->in_use.load(std::memory_order_relaxed) &&
+            it->in_use.compare_exchange_strong(expected, true)) {
+            // 复用的队列可能还留有前一个线程未消费的记录, 照常继续写入即可
+            ring = it;
+            break;
         }
     }
+
+    if (ring == nullptr) {
+        ring = new (InternalArena::Allocate(sizeof(ThreadEventRing))) ThreadEventRing();
+        ring->in_use.store(true, std::memory_order_relaxed);
+        ring->bytes_until_sample = 0;
+        // 每个队列的随机数序列不同即可, 不要求密码学强度
+        ring->sample_rng = TickClock::Now() ^ reinterpret_cast<uintptr_t>(ring);
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->tail.store(0, std::memory_order_relaxed);
+        ThreadEventRing* old_head = g_ring_head.load(std::memory_order_relaxed);
+        do {
+            ring->next = old_head;
+        } while (!g_ring_head.compare_exchange_weak(
+                old_head, ring, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+    g_thread_ring = ring;
+#endif
+    pthread_setspecific(g_ring_key, ring);
+    return ring;
 }
 
-size_t PointerData::AddBacktrace(size_t num_frames, size_t size_bytes) {
-    if (!ShouldBacktraceAllocSize(size_bytes)) {
-        return kBacktraceEmptyIndex;
+void PointerData::RingThreadExit(void* data) {
+    ThreadEventRing* ring = static_cast<ThreadEventRing*>(data);
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+    g_thread_ring = nullptr;
+#endif
+    // 未消费的记录留在队列里, 由汇总线程照常处理
+    ring->in_use.store(false, std::memory_order_release);
+}
+
+void PointerData::StartAggregator() {
+    bool expected = false;
+    if (!g_aggregator_started.compare_exchange_strong(expected, true)) {
+        return;
     }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    // 创建失败时队列满了由生产者自己消费, 见 WaitForSpace
+    pthread_create(&thread, &attr, AggregatorMain, this);
+    pthread_attr_destroy(&attr);
+}
 
-    std::vector<uintptr_t> frames;
-    std::vector<unwindstack::FrameData> frames_info;
-    if (g_debug->config().options() & BACKTRACE) {
-        switch (Unwind(&frames, &frames_info, num_frames)) {
-            case unwindstack::ERROR_NONE:
-            case unwindstack::ERROR_MAX_FRAMES_EXCEEDED:
-                break;
-            case unwindstack::ERROR_EXIT_FUNC:
-                return kBacktraceExitIndex;
-            default:
-                return kBacktraceEmptyIndex;
+void* PointerData::AggregatorMain(void* data) {
+    PointerData* pointer_data = static_cast<PointerData*>(data);
+    // 汇总线程释放堆栈等数据时不能再被记录
+    DebugDisableSet(true);
+    while (!g_aggregator_stop.load(std::memory_order_relaxed)) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += kAggregatorPeriodNs;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
         }
-    } else {
-        return kBacktraceEmptyIndex;
-    }
-
-    FrameKeyType key{.num_frames = frames.size(), .frames = frames.data()};
-    size_t hash_index;
-    std::lock_guard<std::mutex> frame_guard(frame_mutex_);
-    auto entry = key_to_index_.find(key);
-    if (entry == key_to_index_.end()) {
-        hash_index = cur_hash_index_++;
-        key.frames = frames.data();
-        key_to_index_.emplace(key, hash_index);
-
-        frames_.emplace(
-                hash_index,
-                FrameInfoType{.references = 1, .frames = std::move(frames)});
-        if (g_debug->config().options() & BACKTRACE) {
-            backtraces_info_.emplace(
-                    hash_index,
-                    std::make_shared<std::vector<unwindstack::FrameData>>(frames_info));
+        pthread_mutex_lock(&g_aggregator_mutex);
+        pthread_cond_timedwait(&g_aggregator_cond, &g_aggregator_mutex, &deadline);
+        pthread_mutex_unlock(&g_aggregator_mutex);
+
+        std::lock_guard<std::mutex> drain_guard(pointer_data->drain_mutex_);
+        if (g_aggregator_stop.load(std::memory_order_relaxed)) {
+            break;
         }
-    } else {
-        hash_index = entry->second;
-        FrameInfoType* frame_info = &frames_[hash_index];
-        frame_info->references++;
+        pointer_data->DrainRings(TickClock::Now());
+    }
+    return nullptr;
+}
+
+void PointerData::StopAggregator() {
+    g_aggregator_stop.store(true, std::memory_order_relaxed);
+    pthread_cond_signal(&g_aggregator_cond);
+}
+
+bool PointerData::WaitForSpace(ThreadEventRing* ring, bool droppable) {
+    static bool drop_on_full = g_debug->config().options() & DROP_EVENTS_ON_FULL;
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    while (head - ring->tail.load(std::memory_order_acquire) == kEventRingSize) {
+        if (droppable && drop_on_full) {
+            return false;
+        }
+        pthread_cond_signal(&g_aggregator_cond);
+        // 汇总线程不在运行 (启动失败或正在 fork 后重启) 时自己消费
+        if (drain_mutex_.try_lock()) {
+            DrainRings(TickClock::Now());
+            drain_mutex_.unlock();
+        } else {
+            sched_yield();
+        }
+    }
+    return true;
+}
+
+void PointerData::Push(
+        ThreadEventRing* ring, EventKind kind, uintptr_t pointer, size_t size,
+        StackCapture* stack, uint64_t ticks, MemType type) {
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    AllocEvent& event = ring->events[head & (kEventRingSize - 1)];
+    event.pointer = pointer;
+    event.size = size;
+    event.stack = stack;
+    event.ticks = ticks;
+    event.kind.store(kind, std::memory_order_relaxed);
+    event.mem_type = type;
+    ring->head.store(head + 1, std::memory_order_release);
+    if (head + 1 - ring->tail.load(std::memory_order_relaxed) == kEventRingSize / 2) {
+        pthread_cond_signal(&g_aggregator_cond);
+    }
+}
+
+void PointerData::Add(const void* ptr, size_t pointer_size, MemType type) {
+    // 分配失败的结果不记录, 也省去一次 unwind
+    if (ptr == nullptr || ptr == MAP_FAILED) {
+        return;
+    }
+
+    if (sample_interval_ != 0 && type == HOST &&
+        !ShouldSample(CurrentRing(), pointer_size)) {
+        return;
+    }
+
+    StackCapture* stack;
+    // unwind 跳过的函数，不记录其堆栈和 pointer 信息
+    if (!CaptureBacktrace(pointer_size, &stack)) {
+        return;
     }
-    return hash_index;
+
+    ThreadEventRing* ring = CurrentRing();
+    if (!WaitForSpace(ring, true)) {
+        dropped_events_.fetch_add(1, std::memory_order_relaxed);
+        dropped_bytes_.fetch_add(pointer_size, std::memory_order_relaxed);
+        if (stack != nullptr) {
+            stack->~StackCapture();
+            InternalArena::Free(stack, sizeof(StackCapture));
+        }
+        return;
+    }
+    Push(ring, kEventAdd, reinterpret_cast<uintptr_t>(ptr), pointer_size, stack,
+         TickClock::Now(), type);
 }
 
 void PointerData::Remove(const void* ptr) {
-    size_t hash_index;
-    {
-        std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
-        uintptr_t mangled_ptr = ManglePointer(reinterpret_cast<uintptr_t>(ptr));
-        auto entry = pointers_.find(mangled_ptr);
-        if (entry == pointers_.end()) {
-            // No tracked pointer.
+    if (ptr == nullptr) {
+        return;
+    }
+
+    uintptr_t pointer = reinterpret_cast<uintptr_t>(ptr);
+    ThreadEventRing* ring = CurrentRing();
+    // 释放记录不能丢弃, 否则会留下已释放的指针
+    WaitForSpace(ring, false);
+
+    // 短命的临时分配通常在被消费前就被释放, 从后往前找最近的分配直接抵消
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    size_t tail = ring->tail.load(std::memory_order_acquire);
+    size_t stop = head - std::min(head - tail, kLocalCancelWindow);
+    for (size_t i = head; i-- > stop;) {
+        AllocEvent& event = ring->events[i & (kEventRingSize - 1)];
+        if (event.pointer != pointer) {
+            continue;
+        }
+        uint8_t expected = kEventAdd;
+        if (event.kind.compare_exchange_strong(
+                    expected, kEventCancelledAdd, std::memory_order_relaxed)) {
+            Push(ring, kEventCancelledRemove, pointer, event.size, nullptr,
+                 TickClock::Now(), event.mem_type);
             return;
         }
-        current_used -= entry->second.size;
-        size_t* target = (entry->second.mem_type == DMA) ? &current_dma : &current_host;
-        *target -= entry->second.size;
-        hash_index = entry->second.hash_index;
-        pointers_.erase(mangled_ptr);
+        // 已被消费者取走, 或者是更早的释放记录, 按普通释放处理
+        break;
     }
+    Push(ring, kEventRemove, pointer, 0, nullptr, TickClock::Now(), HOST);
+}
 
-    RemoveBacktrace(hash_index);
+int64_t PointerData::NextSampleInterval(ThreadEventRing* ring) {
+    // xorshift64*, 取高 53 位得到 (0, 1] 上的均匀分布, 再变换为指数分布
+    uint64_t x = ring->sample_rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ring->sample_rng = x;
+    double uniform = static_cast<double>(((x * 0x2545f4914f6cdd1dULL) >> 11) + 1) /
+                     9007199254740992.0;
+    int64_t interval = static_cast<int64_t>(-std::log(uniform) * sample_interval_);
+    return std::max<int64_t>(interval, 1);
 }
 
-void PointerData::RemoveBacktrace(size_t hash_index) {
-    if (hash_index <= kBacktraceEmptyIndex) {
+bool PointerData::ShouldSample(ThreadEventRing* ring, size_t size) {
+    // 字节流上的泊松过程: 每个线程维护到下一个采样点的距离, 分配跨过采样点即被采中
+    int64_t bytes = static_cast<int64_t>(std::min<size_t>(size, INT64_MAX));
+    if (__builtin_expect(ring->bytes_until_sample == 0, 0)) {
+        ring->bytes_until_sample = NextSampleInterval(ring);
+    }
+    if (bytes < ring->bytes_until_sample) {
+        ring->bytes_until_sample -= bytes;
+        return false;
+    }
+    if (bytes / static_cast<int64_t>(sample_interval_) > 64) {
+        // 远大于采样间隔的分配几乎必然被采中, 不再逐个跨过采样点
+        ring->bytes_until_sample = NextSampleInterval(ring);
+        return true;
+    }
+    bytes -= ring->bytes_until_sample;
+    ring->bytes_until_sample = NextSampleInterval(ring);
+    while (bytes >= ring->bytes_until_sample) {
+        bytes -= ring->bytes_until_sample;
+        ring->bytes_until_sample = NextSampleInterval(ring);
+    }
+    ring->bytes_until_sample -= bytes;
+    return true;
+}
+
+size_t PointerData::EstimatedSize(size_t size, MemType type) const {
+    if (sample_interval_ == 0 || type != HOST || size == 0) {
+        return size;
+    }
+    // 长度为 size 的区间内至少有一个采样点的概率
+    double probability = -std::expm1(-static_cast<double>(size) / sample_interval_);
+    return static_cast<size_t>(std::llround(size / probability));
+}
+
+void PointerData::UpdateUsage(MemType type, int64_t bytes) {
+    std::atomic<size_t>* current = &current_host;
+    std::atomic<size_t>* peak = &peak_host;
+    if (type == DMA) {
+        current = &current_dma;
+        peak = &peak_dma;
+    } else if (type == GPU) {
+        current = &current_gpu;
+        peak = &peak_gpu;
+    }
+    size_t used = current_used.load(std::memory_order_relaxed) + bytes;
+    size_t typed = current->load(std::memory_order_relaxed) + bytes;
+    current_used.store(used, std::memory_order_relaxed);
+    current->store(typed, std::memory_order_relaxed);
+    if (bytes < 0) {
         return;
     }
+    UpdatePeak(peak, typed);
+    if (UpdatePeak(&peak_tot, used) &&
+        (g_debug->config().options() & RECORD_MEMORY_PEAK)) {
+        peak_pending_ = true;
+    }
+}
+
+void PointerData::ProcessEvent(AllocEvent* event) {
+    uint8_t kind = event->kind.load(std::memory_order_relaxed);
+    if (kind == kEventAdd) {
+        // 与生产者的抵消争用, 换成 kEventConsumed 后生产者不会再改动这条记录
+        kind = event->kind.exchange(kEventConsumed, std::memory_order_relaxed);
+    }
+
+    // 用量即将回落, 先把刚才的峰值记录下来
+    if (peak_pending_ && kind != kEventAdd && kind != kEventCancelledAdd) {
+        peak_pending_ = false;
+        RecordPeak();
+    }
 
-    std::lock_guard<std::mutex> frame_guard(frame_mutex_);
-    auto frame_entry = frames_.find(hash_index);
-    if (frame_entry == frames_.end()) {
-        // does not have matching frame data.
+    switch (kind) {
+        case kEventCancelledAdd:
+            if (event->stack != nullptr) {
+                event->stack->~StackCapture();
+                InternalArena::Free(event->stack, sizeof(StackCapture));
+            }
+            UpdateUsage(event->mem_type, EstimatedSize(event->size, event->mem_type));
+            return;
+        case kEventCancelledRemove:
+            UpdateUsage(
+                    event->mem_type,
+                    -static_cast<int64_t>(EstimatedSize(event->size, event->mem_type)));
+            return;
+        default:
+            break;
+    }
+
+    uintptr_t mangled_ptr = ManglePointer(event->pointer);
+    PointerShard& shard = Shard(mangled_ptr);
+    PointerInfoType info;
+    if (shard.pointers.Erase(mangled_ptr, &info)) {
+        callsites_.Remove(CallsiteKey{info.Size(), info.stack_id, info.Type()});
+        // 分配记录里再次出现同一地址时, 说明旧的释放没有被记录到
+        UpdateUsage(
+                info.Type(),
+                -static_cast<int64_t>(EstimatedSize(info.Size(), info.Type())));
+    }
+    if (kind == kEventRemove) {
         return;
     }
-    FrameInfoType* frame_info = &frame_entry->second;
-    if (--frame_info->references == 0) {
-        FrameKeyType key{
-                .num_frames = frame_info->frames.size(),
-                .frames = frame_info->frames.data()};
-        key_to_index_.erase(key);
-        frames_.erase(hash_index);
-        if (g_debug->config().options() & BACKTRACE) {
-            backtraces_info_.erase(hash_index);
+
+    uint32_t stack_id = event->stack == nullptr ? StackTable::kNoStack
+                                                : InternBacktrace(event->stack);
+    if (shard.pointers.Insert(
+                mangled_ptr,
+                PointerInfoType::Pack(
+                        event->size, stack_id, event->mem_type, event->ticks))) {
+        callsites_.Add(
+                CallsiteKey{event->size, stack_id, event->mem_type}, event->ticks);
+    }
+    UpdateUsage(event->mem_type, EstimatedSize(event->size, event->mem_type));
+}
+
+void PointerData::DrainRings(uint64_t watermark) {
+    // 先确定时间上限再读取各队列的 head. 同一地址上有先后关系的两条记录,
+    // 前一条在后一条产生之前就已写入队列, 只要后一条不晚于上限就一定能看到前一条.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    struct Cursor {
+        ThreadEventRing* ring;
+        size_t pos;
+        size_t end;
+    };
+    auto event_at = [](const Cursor& cursor) -> AllocEvent* {
+        return &cursor.ring->events[cursor.pos & (kEventRingSize - 1)];
+    };
+    // 小顶堆按时间合并各队列; 时间相同时先处理分配, 跨线程传递指针后立即释放
+    // 比释放后被其它线程重新分配 (中间隔着一次 unwind) 更容易落在同一时刻
+    auto later = [&event_at](const Cursor& a, const Cursor& b) {
+        AllocEvent* x = event_at(a);
+        AllocEvent* y = event_at(b);
+        if (x->ticks != y->ticks) {
+            return x->ticks > y->ticks;
         }
+        return x->kind.load(std::memory_order_relaxed) == kEventRemove &&
+               y->kind.load(std::memory_order_relaxed) != kEventRemove;
+    };
+
+    InternalVector<Cursor> heap;
+    for (ThreadEventRing* it = g_ring_head.load(std::memory_order_acquire);
+         it != nullptr; it = it->next) {
+        Cursor cursor{
+                it, it->tail.load(std::memory_order_relaxed),
+                it->head.load(std::memory_order_acquire)};
+        if (cursor.pos != cursor.end && event_at(cursor)->ticks <= watermark) {
+            heap.push_back(cursor);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Cursor& cursor = heap.back();
+        ProcessEvent(event_at(cursor));
+        cursor.pos++;
+        cursor.ring->tail.store(cursor.pos, std::memory_order_release);
+        if (cursor.pos != cursor.end && event_at(cursor)->ticks <= watermark) {
+            std::push_heap(heap.begin(), heap.end(), later);
+        } else {
+            heap.pop_back();
+        }
+    }
+
+    if (peak_pending_) {
+        peak_pending_ = false;
+        RecordPeak();
     }
 }
 
-void PointerData::GetList(
-        std::vector<ListInfoType>* list, bool only_with_backtrace, Pred pred) {
-    for (auto& entry : pointers_) {
-        FrameInfoType* frame_info = nullptr;
-        std::shared_ptr<std::vector<unwindstack::FrameData>> backtrace_info;
-        uintptr_t pointer = DemanglePointer(entry.first);
-        size_t hash_index = entry.second.hash_index;
-        if (hash_index > kBacktraceEmptyIndex) {
-            auto frame_entry = frames_.find(hash_index);
-            if (frame_entry == frames_.end()) {
-                // Somehow wound up with a pointer with a valid hash_index, but
-                // no frame data. This should not be possible since adding a pointer
-                // occurs after the hash_index and frame data have been added.
-                // When removing a pointer, the pointer is deleted before the frame
-                // data.
-
-                // Pointer --> hash_index does not exist.
-            } else {
-                frame_info = &frame_entry->second;
-            }
+void PointerData::DrainAllRings() {
+    // 其它线程都已停在 hook 之外, 所有记录都已完整写入
+    std::lock_guard<std::mutex> drain_guard(drain_mutex_);
+    DrainRings(UINT64_MAX);
+}
 
-            if (g_debug->config().options() & BACKTRACE) {
-                auto backtrace_entry = backtraces_info_.find(hash_index);
-                if (backtrace_entry == backtraces_info_.end()) {
-                    // Pointer --> hash_index does not exist.
-                } else {
-                    backtrace_info = backtrace_entry->second;
-                }
-            }
+void PointerData::RecordPeak() {
+    size_t used = current_used.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> peak_guard(peak_mutex_);
+    if (used <= peak_list_used_ ||
+        used <= g_debug->config().backtrace_dump_peak_val()) {
+        return;
+    }
+    peak_list_used_ = used;
+    // 快照只随变化过的调用点更新, 其余条目与上次峰值时相同
+    callsites_.TakeChanges([this](const CallsiteInfo& info) {
+        if (info.count == 0) {
+            peak_callsites_.erase(info.key);
+        } else {
+            peak_callsites_[info.key] = info;
         }
+    });
+}
 
+bool PointerData::CaptureBacktrace(size_t size_bytes, StackCapture** capture) {
+    *capture = nullptr;
+    if (!ShouldBacktraceAllocSize(size_bytes)) {
+        return true;
+    }
+    if (!(g_debug->config().options() & BACKTRACE)) {
+        return true;
+    }
+
+    InternalVector<uintptr_t> frames;
+    InternalVector<uint32_t> map_ids;
+    auto unwind = (g_debug->config().options() & FRAME_POINTER_UNWIND)
+                        ? FramePointerUnwind
+                        : Unwind;
+    switch (unwind(&frames, &map_ids, g_debug->config().backtrace_frames())) {
+        case unwindstack::ERROR_NONE:
+        case unwindstack::ERROR_MAX_FRAMES_EXCEEDED:
+            break;
+        case unwindstack::ERROR_EXIT_FUNC:
+            return false;
+        default:
+            return true;
+    }
+    uint64_t hash = StackTable::Hash(frames.data(), frames.size());
+    *capture = new (InternalArena::Allocate(sizeof(StackCapture)))
+            StackCapture{hash, std::move(frames), std::move(map_ids)};
+    return true;
+}
+
+uint32_t PointerData::InternBacktrace(StackCapture* capture) {
+    uint32_t stack_id = stacks_.Intern(
+            capture->hash, capture->frames.data(), capture->map_ids.data(),
+            capture->frames.size());
+    capture->~StackCapture();
+    InternalArena::Free(capture, sizeof(StackCapture));
+    return stack_id;
+}
+
+void PointerData::GetList(
+        InternalVector<ListInfoType>* list, bool only_with_backtrace, Pred pred) {
+    auto add_entry = [&](uintptr_t mangled_ptr, const PointerInfoType& info) {
         // 舍弃没有堆栈的 pointer
-        if (hash_index <= 1 && only_with_backtrace) {
-            continue;
+        if (info.stack_id == StackTable::kNoStack && only_with_backtrace) {
+            return;
         }
 
         list->emplace_back(ListInfoType{
-                pointer, 1, entry.second.RealSize(), entry.second.mem_type, frame_info,
-                std::move(backtrace_info), entry.second.alloc_time});
-    }
-
-    std::sort(list->begin(), list->end(), pred);
-}
-
-void PointerData::GetUniqueList(
-        std::vector<ListInfoType>* list, bool only_with_backtrace) {
-    // Sort by the size of the allocation.
-    GetList(list, only_with_backtrace,
-            [](const ListInfoType& a, const ListInfoType& b) {
-                if (a.size != b.size)
-                    return a.size > b.size;
-
-                // Put pointers with no backtrace last.
-                FrameInfoType* a_frame = a.frame_info;
-                FrameInfoType* b_frame = b.frame_info;
-                if (a_frame == nullptr && b_frame != nullptr) {
-                    return false;
-                } else if (a_frame != nullptr && b_frame == nullptr) {
-                    return true;
-                } else if (a_frame == nullptr && b_frame == nullptr) {
-                    return a.pointer < b.pointer;
-                }
+                DemanglePointer(mangled_ptr), 1, info.Size(), info.Type(),
+                info.stack_id, info.AllocTicks()});
+    };
+    for (auto& shard : pointer_shards_) {
+        shard.pointers.ForEach(add_entry);
+    }
 
-                // Put the pointers with longest backtrace first.
-                if (a_frame->frames.size() != b_frame->frames.size()) {
-                    return a_frame->frames.size() > b_frame->frames.size();
-                }
+    if (pred != nullptr) {
+        std::sort(list->begin(), list->end(), pred);
+    }
+}
 
-                // Last sort by pointer.
-                return a.pointer < b.pointer;
-            });
+void PointerData::GetCallsites(InternalVector<CallsiteInfo>* list, bool at_peak) {
+    auto add_entry = [list](const CallsiteInfo& info) {
+        // 舍弃没有堆栈的调用点
+        if (info.key.stack_id != StackTable::kNoStack) {
+            list->push_back(info);
+        }
+    };
+    if (at_peak) {
+        std::lock_guard<std::mutex> peak_guard(peak_mutex_);
+        for (const auto& entry : peak_callsites_) {
+            add_entry(entry.second);
+        }
+    } else {
+        std::lock_guard<std::mutex> drain_guard(drain_mutex_);
+        callsites_.ForEach(add_entry);
+    }
+}
 
-    // Remove duplicates of size/backtraces.
-    for (auto iter = list->begin(); iter != list->end();) {
-        auto dup_iter = iter + 1;
-        size_t size = iter->size;
-        FrameInfoType* frame_info = iter->frame_info;
-        for (; dup_iter != list->end(); ++dup_iter) {
-            if (size != dup_iter->size || frame_info != dup_iter->frame_info) {
+// dump 输出缓冲, 攒满后一次 write, 不再每行一次系统调用
+class DumpWriter {
+public:
+    explicit DumpWriter(int fd) : fd_(fd) {}
+    ~DumpWriter() { Flush(); }
+
+    __attribute__((format(printf, 2, 3))) void Printf(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        size_t room = kBufferSize - used_;
+        int len = vsnprintf(buffer_ + used_, room, format, args);
+        va_end(args);
+        if (len < 0) {
+            return;
+        }
+        if (static_cast<size_t>(len) >= room) {
+            // 放不下时先写出已有内容再重新格式化, 超过整个缓冲的行被截断
+            Flush();
+            va_start(args, format);
+            len = vsnprintf(buffer_, kBufferSize, format, args);
+            va_end(args);
+            len = std::min<int>(len, kBufferSize - 1);
+        }
+        used_ += len;
+    }
+
+    void Flush() {
+        size_t written = 0;
+        while (written < used_) {
+            ssize_t n = write(fd_, buffer_ + written, used_ - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
                 break;
             }
-            iter->num_allocations++;
+            written += n;
         }
-        iter = list->erase(iter + 1, dup_iter);
+        used_ = 0;
     }
+
+private:
+    static constexpr size_t kBufferSize = 64 * 1024;
+
+    int fd_;
+    size_t used_ = 0;
+    char buffer_[kBufferSize];
+};
+
+static void DumpBacktrace(DumpWriter& writer, const StackTable::Stack& stack) {
+    for (size_t i = 0; i < stack.num_frames; ++i) {
+        const InternalString& line =
+                Symbolizer::FormatFrame(stack.frames[i], stack.map_ids[i]);
+        writer.Printf("#%0zd %s\n", i, line.c_str());
+    }
+    writer.Printf("\n");
 }
 
-void PointerData::DumpLiveToFile(int fd) {
-    std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
-    std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+// 解析时间, 输出 "年-月-日 时:分:秒.毫秒"
+static void FormatAllocTime(
+        const TickClock::WallAnchor& anchor, uint64_t alloc_ticks,
+        char (&formatted_time)[24]) {
+    struct timespec wall;
+    TickClock::ToWallTime(anchor, alloc_ticks, &wall);
+    struct tm* local_time = localtime(&wall.tv_sec);
+    size_t len = strftime(
+            formatted_time, sizeof(formatted_time), "%Y-%m-%d %H:%M:%S", local_time);
+    snprintf(
+            formatted_time + len, sizeof(formatted_time) - len, ".%ld",
+            wall.tv_nsec / 1000000);
+}
 
-    std::vector<ListInfoType> list = std::move(peak_list);
-    if (!(g_debug->config().options() & RECORD_MEMORY_PEAK)) {
-        list.clear();
-        // Sort by the time of the allocation.
-        GetList(&list, true, [](const ListInfoType& a, const ListInfoType& b) {
-            return a.alloc_time < b.alloc_time;
-        });
+// 大小分布的桶: 0 字节单独一桶, 其余按 2 的幂划分
+static constexpr size_t kSizeBuckets = PointerInfoType::kSizeBits + 1;
+
+static inline size_t SizeBucket(uint64_t size) {
+    return size == 0 ? 0 : 64 - __builtin_clzll(size);
+}
+
+// 桶的边界都是 2 的幂, 换成最大的整单位输出
+static void FormatBucketBound(uint64_t bytes, char (&formatted)[16]) {
+    static constexpr char kUnits[] = "BKMGT";
+    size_t unit = 0;
+    while (bytes >= 1024 && unit + 2 < sizeof(kUnits)) {
+        bytes /= 1024;
+        unit++;
     }
+    snprintf(formatted, sizeof(formatted), "%" PRIu64 "%c", bytes, kUnits[unit]);
+}
 
-    size_t host_use = 0, dma_use = 0;
-    for (const auto& it : list) {
-        size_t bt_size = it.size * it.num_allocations;
-        it.mem_type == DMA ? dma_use += bt_size : host_use += bt_size;
+void PointerData::Snapshot(DumpSnapshot* snapshot) {
+    uint64_t options = g_debug->config().options();
+    // 默认按调用点输出, 代价只与调用点数量有关; 峰值模式输出峰值时刻的调用点
+    snapshot->list_pointers =
+            !(options & RECORD_MEMORY_PEAK) && (options & DUMP_POINTER_LIST);
+    // 泄漏分析按时间先后对比; 峰值和采样关注占用最多的调用点
+    snapshot->sort_by_bytes = (options & RECORD_MEMORY_PEAK) || sample_interval_ != 0;
+    if (snapshot->list_pointers) {
+        std::lock_guard<std::mutex> drain_guard(drain_mutex_);
+        GetList(&snapshot->pointers, true, nullptr);
+    } else {
+        GetCallsites(&snapshot->callsites, options & RECORD_MEMORY_PEAK);
     }
+    snapshot->tool_used_bytes = InternalArena::used_bytes();
+    snapshot->tool_mapped_bytes = InternalArena::mapped_bytes();
+    snapshot->dropped_events = dropped_events_.load(std::memory_order_relaxed);
+    snapshot->dropped_bytes = dropped_bytes_.load(std::memory_order_relaxed);
+}
 
-    dprintf(fd,
-            "current host used: %fMB, current dma used %fMB, current total peak "
-            "used: %fMB\n",
-            host_use / 1024.0 / 1024.0, dma_use / 1024.0 / 1024.0,
-            (host_use + dma_use) / 1024.0 / 1024.0);
-    dprintf(fd,
+void PointerData::WriteSnapshot(int fd, DumpSnapshot* snapshot) {
+    DumpWriter writer(fd);
+    // host 包含匿名 mmap
+    size_t use[4] = {};
+    if (snapshot->list_pointers) {
+        // Sort by the time of the allocation.
+        std::sort(
+                snapshot->pointers.begin(), snapshot->pointers.end(),
+                [](const ListInfoType& a, const ListInfoType& b) {
+                    return a.alloc_ticks < b.alloc_ticks;
+                });
+        for (const auto& it : snapshot->pointers) {
+            use[it.mem_type] +=
+                    EstimatedSize(it.size, it.mem_type) * it.num_allocations;
+        }
+    } else {
+        for (const auto& it : snapshot->callsites) {
+            MemType type = static_cast<MemType>(it.key.mem_type);
+            use[type] += EstimatedSize(it.key.size, type) * it.count;
+        }
+    }
+    size_t host_use = use[HOST] + use[MMAP];
+
+    writer.Printf(
+            "current host used: %fMB, current dma used %fMB, current gpu used %fMB, "
+            "current total peak used: %fMB\n",
+            host_use / 1024.0 / 1024.0, use[DMA] / 1024.0 / 1024.0,
+            use[GPU] / 1024.0 / 1024.0,
+            (host_use + use[DMA] + use[GPU]) / 1024.0 / 1024.0);
+    // 工具自身的内存单独统计, 不计入上面的 host/dma/gpu
+    writer.Printf(
+            "tool arena used: %fMB, tool total mapped: %fMB\n",
+            snapshot->tool_used_bytes / 1024.0 / 1024.0,
+            snapshot->tool_mapped_bytes / 1024.0 / 1024.0);
+    if (g_debug->config().options() & DROP_EVENTS_ON_FULL) {
+        writer.Printf(
+                "dropped allocations: %zu, dropped size: %fMB\n",
+                snapshot->dropped_events, snapshot->dropped_bytes / 1024.0 / 1024.0);
+    }
+    if (sample_interval_ != 0) {
+        writer.Printf(
+                "sampling interval: %zu bytes, host sizes and counts are estimates\n",
+                sample_interval_);
+    }
+    writer.Printf(
             "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
             "+++++++++++++++\n\n");
-    for (const auto& info : list) {
-        // 解析时间
-        struct tm* local_time = localtime(&info.alloc_time.tv_sec);
-        char formatted_time[20];
-        strftime(
-                formatted_time, sizeof(formatted_time), "%Y-%m-%d %H:%M:%S",
-                local_time);
-
-        dprintf(fd,
+
+    if (!snapshot->list_pointers) {
+        DumpCallsites(writer, snapshot->callsites, snapshot->sort_by_bytes);
+        return;
+    }
+
+    TickClock::WallAnchor anchor = TickClock::Anchor();
+    for (const auto& info : snapshot->pointers) {
+        char formatted_time[24];
+        FormatAllocTime(anchor, info.alloc_ticks, formatted_time);
+
+        writer.Printf(
                 "alloc_size:%fKB \t alloc_type:%s \t alloc_num:%zu \t "
-                "alloc_time:%s.%zu\n",
+                "alloc_time:%s\n",
                 info.size / 1024.0, mtype[info.mem_type], info.num_allocations,
-                formatted_time, info.alloc_time.tv_usec / 1000);
-        for (size_t i = 0; i < info.backtrace_info->size(); ++i) {
-            const unwindstack::FrameData* frame = &info.backtrace_info->at(i);
-            auto map_info = frame->map_info;
-
-            std::string line =
-                    android::base::StringPrintf("#%0zd %" PRIx64 " ", i, frame->rel_pc);
-            // so path
-            if (map_info == nullptr) {
-                line += "<unknown>";
-            } else if (map_info->name().empty()) {
-                line += android::base::StringPrintf(
-                        "<anonymous:%" PRIx64 ">", map_info->start());
-            } else {
-                line += map_info->name();
-            }
+                formatted_time);
+        DumpBacktrace(writer, stacks_.Get(info.stack_id));
+    }
+}
+
+void PointerData::DumpCallsites(
+        DumpWriter& writer, const InternalVector<CallsiteInfo>& callsites,
+        bool sort_by_bytes) {
+    // 按 (堆栈, 类型) 汇总. 采样模式下每条记录按被采中概率的倒数放大,
+    // 总和是该调用点存活字节数和分配次数的无偏估计. 最早的分配时间取各大小条目
+    // 变为存活时的时间, 同一条目中更早的分配已被释放时会偏早.
+    struct CallsiteSummary {
+        uint32_t stack_id;
+        MemType mem_type;
+        size_t samples;
+        size_t bytes;
+        double count;
+        uint64_t oldest_ticks;
+        uint64_t newest_ticks;
+        size_t histogram[kSizeBuckets];
+    };
+    InternalUnorderedMap<uint64_t, CallsiteSummary> summaries;
+    for (const auto& info : callsites) {
+        MemType type = static_cast<MemType>(info.key.mem_type);
+        uint64_t key = static_cast<uint64_t>(info.key.stack_id) << 2 | type;
+        size_t estimated = EstimatedSize(info.key.size, type);
+        auto entry = summaries.emplace(
+                key, CallsiteSummary{
+                             info.key.stack_id,
+                             type,
+                             0,
+                             0,
+                             0.0,
+                             info.first_ticks,
+                             info.last_ticks,
+                             {}});
+        CallsiteSummary& summary = entry.first->second;
+        summary.oldest_ticks = std::min(summary.oldest_ticks, info.first_ticks);
+        summary.newest_ticks = std::max(summary.newest_ticks, info.last_ticks);
+        summary.samples += info.count;
+        summary.bytes += estimated * info.count;
+        summary.count += info.key.size == 0 ? info.count
+                                            : static_cast<double>(estimated) /
+                                                      info.key.size * info.count;
+        summary.histogram[SizeBucket(info.key.size)] += info.count;
+    }
 
-            if (!frame->function_name.empty()) {
-                line += " (";
-                char* demangled_name = abi::__cxa_demangle(
-                        frame->function_name.c_str(), nullptr, nullptr, nullptr);
-                if (demangled_name != nullptr) {
-                    line += demangled_name;
-                    free(demangled_name);
-                } else {
-                    line += frame->function_name;
+    InternalVector<const CallsiteSummary*> sorted;
+    sorted.reserve(summaries.size());
+    for (const auto& entry : summaries) {
+        sorted.push_back(&entry.second);
+    }
+    std::sort(
+            sorted.begin(), sorted.end(),
+            [sort_by_bytes](const CallsiteSummary* a, const CallsiteSummary* b) {
+                if (sort_by_bytes && a->bytes != b->bytes) {
+                    return a->bytes > b->bytes;
                 }
-                if (frame->function_offset != 0) {
-                    line += "+" + std::to_string(frame->function_offset);
+                if (a->oldest_ticks != b->oldest_ticks) {
+                    return a->oldest_ticks < b->oldest_ticks;
                 }
-                line += ")";
+                return a->stack_id < b->stack_id;
+            });
+
+    TickClock::WallAnchor anchor = TickClock::Anchor();
+    for (const CallsiteSummary* summary : sorted) {
+        char oldest_time[24], newest_time[24];
+        FormatAllocTime(anchor, summary->oldest_ticks, oldest_time);
+        FormatAllocTime(anchor, summary->newest_ticks, newest_time);
+
+        if (sample_interval_ != 0) {
+            writer.Printf(
+                    "alloc_size:%fKB \t alloc_type:%s \t alloc_num:%.1f \t "
+                    "samples:%zu \t alloc_time:%s \t last_alloc_time:%s\n",
+                    summary->bytes / 1024.0, mtype[summary->mem_type], summary->count,
+                    summary->samples, oldest_time, newest_time);
+        } else {
+            writer.Printf(
+                    "alloc_size:%fKB \t alloc_type:%s \t alloc_num:%zu \t "
+                    "alloc_time:%s \t last_alloc_time:%s\n",
+                    summary->bytes / 1024.0, mtype[summary->mem_type], summary->samples,
+                    oldest_time, newest_time);
+        }
+        writer.Printf("size_histogram:");
+        for (size_t bucket = 0; bucket < kSizeBuckets; bucket++) {
+            if (summary->histogram[bucket] == 0) {
+                continue;
+            }
+            if (bucket == 0) {
+                writer.Printf(" 0B:%zu", summary->histogram[bucket]);
+                continue;
             }
-            dprintf(fd, "%s\n", line.c_str());
+            char low[16], high[16];
+            FormatBucketBound(uint64_t{1} << (bucket - 1), low);
+            FormatBucketBound(uint64_t{1} << bucket, high);
+            writer.Printf(" %s-%s:%zu", low, high, summary->histogram[bucket]);
         }
-        dprintf(fd, "\n");
+        writer.Printf("\n");
+        DumpBacktrace(writer, stacks_.Get(summary->stack_id));
     }
 }
 
 void PointerData::DumpPeakInfo() {
-    std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
     printf("\n+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
            "++++++++++++++++\n");
-    printf("host peak used: %fMB, dma peak used %fMB, total peak used: %fMB\n\n",
-           peak_host / 1024.0 / 1024.0, peak_dma / 1024.0 / 1024.0,
-           peak_tot / 1024.0 / 1024.0);
+    printf("host peak used: %fMB, dma peak used %fMB, gpu peak used %fMB, total peak "
+           "used: %fMB\n\n",
+           peak_host.load() / 1024.0 / 1024.0, peak_dma.load() / 1024.0 / 1024.0,
+           peak_gpu.load() / 1024.0 / 1024.0, peak_tot.load() / 1024.0 / 1024.0);
 }
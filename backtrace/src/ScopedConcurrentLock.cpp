@@ -0,0 +1,146 @@
+#include <sched.h>
+#include <cstdlib>
+#include <new>
+
+#include "InternalAllocator.h"
+#include "ScopedConcurrentLock.h"
+
+static constexpr size_t kEpochPageSize = 4096;
+
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+DEBUG_TLS ThreadEpoch* ScopedConcurrentLock::tls_epoch_ = nullptr;
+#endif
+
+std::atomic<ThreadEpoch*> ScopedConcurrentLock::head_{nullptr};
+std::atomic<bool> ScopedConcurrentLock::blocked_{false};
+std::atomic<ThreadEpoch*> ScopedConcurrentLock::owner_{nullptr};
+pthread_key_t ScopedConcurrentLock::exit_key_;
+pthread_mutex_t ScopedConcurrentLock::block_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t ScopedConcurrentLock::wait_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t ScopedConcurrentLock::wait_cond_ = PTHREAD_COND_INITIALIZER;
+
+void ScopedConcurrentLock::Init() {
+    pthread_key_create(&exit_key_, ThreadExit);
+    pthread_atfork(nullptr, nullptr, AtForkChild);
+}
+
+ThreadEpoch* ScopedConcurrentLock::RegisterThread() {
+    ThreadEpoch* epoch = nullptr;
+    // 优先复用已退出线程留下的记录
+    for (ThreadEpoch* it = head_.load(std::memory_order_acquire); it != nullptr;
+         it = it->next) {
+        bool expected = false;
+        if (!it->in_use.load(std::memory_order_relaxed) &&
+            it->in_use.compare_exchange_strong(expected, true)) {
+            epoch = it;
+            break;
+        }
+    }
+
+    if (epoch == nullptr) {
+        void* page = InternalArena::MapPages(kEpochPageSize);
+        if (page == nullptr) {
+            abort();
+        }
+        ThreadEpoch* records = static_cast<ThreadEpoch*>(page);
+        size_t count = kEpochPageSize / sizeof(ThreadEpoch);
+        for (size_t i = 0; i < count; i++) {
+            new (&records[i]) ThreadEpoch{{0}, {i == 0}, nullptr};
+        }
+        for (size_t i = 0; i + 1 < count; i++) {
+            records[i].next = &records[i + 1];
+        }
+        epoch = &records[0];
+        // 整页记录一次性挂到链表头部
+        ThreadEpoch* old_head = head_.load(std::memory_order_relaxed);
+        do {
+            records[count - 1].next = old_head;
+        } while (!head_.compare_exchange_weak(
+                old_head, &records[0], std::memory_order_release,
+                std::memory_order_relaxed));
+    }
+
+    // 先设置 TLS 再 pthread_setspecific, 后者内部可能分配内存并重入 hook
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+    tls_epoch_ = epoch;
+#endif
+    pthread_setspecific(exit_key_, epoch);
+    return epoch;
+}
+
+void ScopedConcurrentLock::EnterSlow(ThreadEpoch* epoch) {
+    if (owner_.load(std::memory_order_relaxed) == epoch) {
+        // BlockAllOperations 的调用者自身重入, 例如 debug_finalize 中 dump
+        return;
+    }
+    while (true) {
+        // 撤销本次进入, 睡眠等待阻塞解除后重试
+        epoch->active.store(0, std::memory_order_release);
+        pthread_mutex_lock(&wait_mutex_);
+        while (blocked_.load(std::memory_order_relaxed)) {
+            pthread_cond_wait(&wait_cond_, &wait_mutex_);
+        }
+        pthread_mutex_unlock(&wait_mutex_);
+
+        epoch->active.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!blocked_.load(std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
+
+void ScopedConcurrentLock::BlockAllOperations() {
+    ThreadEpoch* self = CurrentEpoch();
+    if (self == nullptr) {
+        self = RegisterThread();
+    }
+
+    pthread_mutex_lock(&block_mutex_);
+    owner_.store(self, std::memory_order_relaxed);
+    blocked_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // 等待其它线程进行中的调用排空
+    for (ThreadEpoch* it = head_.load(std::memory_order_acquire); it != nullptr;
+         it = it->next) {
+        if (it == self) {
+            continue;
+        }
+        while (it->active.load(std::memory_order_acquire) != 0) {
+            sched_yield();
+        }
+    }
+}
+
+void ScopedConcurrentLock::UnblockAllOperations() {
+    owner_.store(nullptr, std::memory_order_relaxed);
+    pthread_mutex_lock(&wait_mutex_);
+    blocked_.store(false, std::memory_order_relaxed);
+    pthread_cond_broadcast(&wait_cond_);
+    pthread_mutex_unlock(&wait_mutex_);
+    pthread_mutex_unlock(&block_mutex_);
+}
+
+void ScopedConcurrentLock::ThreadExit(void* data) {
+    ThreadEpoch* epoch = static_cast<ThreadEpoch*>(data);
+#if !DEBUG_USE_PTHREAD_KEY_TLS
+    if (tls_epoch_ == epoch) {
+        tls_epoch_ = nullptr;
+    }
+#endif
+    epoch->active.store(0, std::memory_order_relaxed);
+    epoch->in_use.store(false, std::memory_order_release);
+}
+
+void ScopedConcurrentLock::AtForkChild() {
+    // fork 后子进程只剩当前线程, 其余线程的记录不会再退出, 直接回收
+    ThreadEpoch* self = CurrentEpoch();
+    for (ThreadEpoch* it = head_.load(std::memory_order_relaxed); it != nullptr;
+         it = it->next) {
+        if (it != self) {
+            it->active.store(0, std::memory_order_relaxed);
+            it->in_use.store(false, std::memory_order_relaxed);
+        }
+    }
+}
@@ -0,0 +1,113 @@
+#include <string.h>
+
+#include "StackTable.h"
+
+bool StackTable::Equals(
+        const Record& record, uint64_t hash, const uintptr_t* frames,
+        size_t num_frames) const {
+    // 64 位哈希几乎不会碰撞, 相等时再比较一次内容保证不会把不同堆栈合并
+    return record.hash == hash && record.num_frames == num_frames &&
+           memcmp(record.frames, frames, num_frames * sizeof(uintptr_t)) == 0;
+}
+
+bool StackTable::Reserve(size_t num_frames, uintptr_t** frames, uint32_t** map_ids) {
+    if (num_frames > kFrameChunkSize) {
+        return false;
+    }
+    // 一个堆栈不跨块, 当前块剩余空间不够时直接开新块
+    if (frame_chunk_used_ + num_frames > kFrameChunkSize) {
+        if (frame_chunk_count_ == kMaxFrameChunks) {
+            return false;
+        }
+        // 整页映射, 没有写到的部分不占物理内存
+        void* frame_chunk =
+                InternalArena::MapPages(kFrameChunkSize * sizeof(uintptr_t));
+        void* map_id_chunk =
+                InternalArena::MapPages(kFrameChunkSize * sizeof(uint32_t));
+        if (frame_chunk == nullptr || map_id_chunk == nullptr) {
+            if (frame_chunk != nullptr) {
+                InternalArena::UnmapPages(
+                        frame_chunk, kFrameChunkSize * sizeof(uintptr_t));
+            }
+            if (map_id_chunk != nullptr) {
+                InternalArena::UnmapPages(
+                        map_id_chunk, kFrameChunkSize * sizeof(uint32_t));
+            }
+            return false;
+        }
+        frame_chunks_[frame_chunk_count_] = static_cast<uintptr_t*>(frame_chunk);
+        map_id_chunks_[frame_chunk_count_] = static_cast<uint32_t*>(map_id_chunk);
+        frame_chunk_count_++;
+        frame_chunk_used_ = 0;
+    }
+    *frames = frame_chunks_[frame_chunk_count_ - 1] + frame_chunk_used_;
+    *map_ids = map_id_chunks_[frame_chunk_count_ - 1] + frame_chunk_used_;
+    frame_chunk_used_ += num_frames;
+    return true;
+}
+
+void StackTable::Grow() {
+    InternalVector<Slot> old_slots;
+    old_slots.swap(slots_);
+    slots_.assign(old_slots.empty() ? 1024 : old_slots.size() * 2, Slot{0, kNoStack});
+    size_t mask = slots_.size() - 1;
+    for (const Slot& slot : old_slots) {
+        if (slot.id == kNoStack) {
+            continue;
+        }
+        size_t index = slot.hash & mask;
+        while (slots_[index].id != kNoStack) {
+            index = (index + 1) & mask;
+        }
+        slots_[index] = slot;
+    }
+}
+
+uint32_t StackTable::Intern(
+        uint64_t hash, const uintptr_t* frames, const uint32_t* map_ids,
+        size_t num_frames) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t count = num_stacks_.load(std::memory_order_relaxed);
+    // 负载不超过一半, 线性探测的平均长度保持很短
+    if ((count + 1) * 2 > slots_.size()) {
+        Grow();
+    }
+    size_t mask = slots_.size() - 1;
+    size_t index = hash & mask;
+    for (; slots_[index].id != kNoStack; index = (index + 1) & mask) {
+        if (slots_[index].hash == hash) {
+            uint32_t id = slots_[index].id;
+            const Record& record = record_chunks_[(id - 1) / kRecordChunkSize].load(
+                    std::memory_order_relaxed)[(id - 1) % kRecordChunkSize];
+            if (Equals(record, hash, frames, num_frames)) {
+                return id;
+            }
+        }
+    }
+
+    if (count == kMaxRecordChunks * kRecordChunkSize) {
+        return kNoStack;
+    }
+    std::atomic<Record*>& record_chunk = record_chunks_[count / kRecordChunkSize];
+    if (record_chunk.load(std::memory_order_relaxed) == nullptr) {
+        void* chunk = InternalArena::MapPages(kRecordChunkSize * sizeof(Record));
+        if (chunk == nullptr) {
+            return kNoStack;
+        }
+        record_chunk.store(static_cast<Record*>(chunk), std::memory_order_release);
+    }
+    uintptr_t* stored_frames;
+    uint32_t* stored_map_ids;
+    if (!Reserve(num_frames, &stored_frames, &stored_map_ids)) {
+        return kNoStack;
+    }
+    memcpy(stored_frames, frames, num_frames * sizeof(uintptr_t));
+    memcpy(stored_map_ids, map_ids, num_frames * sizeof(uint32_t));
+    record_chunk.load(std::memory_order_relaxed)[count % kRecordChunkSize] = Record{
+            hash, stored_frames, stored_map_ids, static_cast<uint32_t>(num_frames)};
+
+    uint32_t id = static_cast<uint32_t>(count + 1);
+    slots_[index] = Slot{hash, id};
+    num_stacks_.store(count + 1, std::memory_order_release);
+    return id;
+}
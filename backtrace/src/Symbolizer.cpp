@@ -0,0 +1,113 @@
+#include <cxxabi.h>
+#include <inttypes.h>
+
+#include <cstdlib>
+#include <mutex>
+
+#include <android-base/stringprintf.h>
+#include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/Regs.h>
+
+#include "Symbolizer.h"
+#include "UnwindBacktrace.h"
+
+namespace {
+
+struct FrameKey {
+    uintptr_t pc;
+    uint32_t map_id;
+
+    bool operator==(const FrameKey& other) const {
+        return pc == other.pc && map_id == other.map_id;
+    }
+};
+
+struct FrameKeyHash {
+    size_t operator()(const FrameKey& key) const {
+        return std::hash<uintptr_t>()(
+                key.pc ^ (static_cast<uintptr_t>(key.map_id) << 40));
+    }
+};
+
+struct SymbolizerState {
+    std::mutex mutex;
+    // 下标为编号减一
+    InternalVector<std::shared_ptr<unwindstack::MapInfo>> maps;
+    InternalUnorderedMap<FrameKey, InternalString, FrameKeyHash> frames;
+};
+
+// 首次使用时构造: hook 可能早于本文件的全局对象初始化被调用
+SymbolizerState& State() {
+    [[clang::no_destroy]] static SymbolizerState state;
+    return state;
+}
+
+}  // namespace
+
+uint32_t Symbolizer::RegisterMap(
+        const std::shared_ptr<unwindstack::MapInfo>& map_info) {
+    SymbolizerState& state = State();
+    std::lock_guard<std::mutex> guard(state.mutex);
+    uint32_t id = map_info->user_id();
+    if (id == 0) {
+        state.maps.push_back(map_info);
+        id = static_cast<uint32_t>(state.maps.size());
+        map_info->set_user_id(id);
+    }
+    return id;
+}
+
+const InternalString& Symbolizer::FormatFrame(uintptr_t pc, uint32_t map_id) {
+    SymbolizerState& state = State();
+    std::lock_guard<std::mutex> guard(state.mutex);
+    auto entry = state.frames.find(FrameKey{pc, map_id});
+    if (entry != state.frames.end()) {
+        return entry->second;
+    }
+
+    std::shared_ptr<unwindstack::MapInfo> map_info;
+    if (map_id != 0 && map_id <= state.maps.size()) {
+        map_info = state.maps[map_id - 1];
+    }
+
+    std::string line;
+    if (map_info == nullptr) {
+        line = android::base::StringPrintf(
+                "%" PRIx64 " <unknown>", static_cast<uint64_t>(pc));
+    } else {
+        unwindstack::Elf* elf = map_info->GetElf(
+                LocalUnwinder().GetProcessMemory(), unwindstack::Regs::CurrentArch());
+        uint64_t rel_pc = elf->GetRelPc(pc, map_info.get());
+        line = android::base::StringPrintf("%" PRIx64 " ", rel_pc);
+        // so path
+        if (map_info->name().empty()) {
+            line += android::base::StringPrintf(
+                    "<anonymous:%" PRIx64 ">", map_info->start());
+        } else {
+            line += map_info->name();
+        }
+
+        unwindstack::SharedString function_name;
+        uint64_t function_offset = 0;
+        if (elf->GetFunctionName(rel_pc, &function_name, &function_offset) &&
+            !function_name.empty()) {
+            line += " (";
+            char* demangled_name = abi::__cxa_demangle(
+                    function_name.c_str(), nullptr, nullptr, nullptr);
+            if (demangled_name != nullptr) {
+                line += demangled_name;
+                free(demangled_name);
+            } else {
+                line += function_name;
+            }
+            if (function_offset != 0) {
+                line += "+" + std::to_string(function_offset);
+            }
+            line += ")";
+        }
+    }
+    return state.frames
+            .emplace(FrameKey{pc, map_id}, InternalString(line.begin(), line.end()))
+            .first->second;
+}
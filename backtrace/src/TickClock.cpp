@@ -0,0 +1,78 @@
+#include <algorithm>
+
+#include "TickClock.h"
+
+namespace {
+
+uint64_t g_start_ticks;
+int64_t g_start_mono_ns;
+
+int64_t ClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 压缩时间的粒度. arm64 定时器几十 MHz 到 1 GHz, TSC 几 GHz, 其它架构是纳秒,
+// 右移 10 位后都在 1 us 上下, 46 位可表示半年以上
+constexpr int kCompressShift = 10;
+
+#if defined(__x86_64__) || defined(__i386__)
+// 标定区间太短时误差大, 不足这个长度先等一等
+constexpr int64_t kMinCalibrationNs = 10 * 1000 * 1000;
+#endif
+
+}  // namespace
+
+void TickClock::Initialize() {
+    g_start_mono_ns = ClockNs(CLOCK_MONOTONIC);
+    g_start_ticks = Now();
+}
+
+uint64_t TickClock::Compress(uint64_t ticks) {
+    if (ticks < g_start_ticks) {
+        return 0;
+    }
+    uint64_t compressed = (ticks - g_start_ticks) >> kCompressShift;
+    // 超出范围时停在最大值, 不回绕
+    return std::min(compressed, (uint64_t{1} << kCompressedBits) - 1);
+}
+
+uint64_t TickClock::Expand(uint64_t compressed) {
+    return g_start_ticks + (compressed << kCompressShift);
+}
+
+TickClock::WallAnchor TickClock::Anchor() {
+    double ns_per_tick = 1.0;
+#if defined(__aarch64__)
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    ns_per_tick = 1e9 / frequency;
+#elif defined(__x86_64__) || defined(__i386__)
+    // 从初始化到现在整段区间标定, 运行越久越准
+    int64_t elapsed_ns = ClockNs(CLOCK_MONOTONIC) - g_start_mono_ns;
+    if (elapsed_ns < kMinCalibrationNs) {
+        struct timespec wait = {0, kMinCalibrationNs - elapsed_ns};
+        nanosleep(&wait, nullptr);
+    }
+    int64_t mono_ns = ClockNs(CLOCK_MONOTONIC);
+    uint64_t ticks = Now();
+    if (ticks > g_start_ticks) {
+        ns_per_tick = static_cast<double>(mono_ns - g_start_mono_ns) /
+                      static_cast<double>(ticks - g_start_ticks);
+    }
+#endif
+    // 两个时钟紧挨着读取, 之间的间隔远小于输出的毫秒精度
+    int64_t wall_ns = ClockNs(CLOCK_REALTIME);
+    return WallAnchor{Now(), wall_ns, ns_per_tick};
+}
+
+void TickClock::ToWallTime(
+        const WallAnchor& anchor, uint64_t ticks, struct timespec* wall) {
+    // 记录一般早于锚点, 用有符号差值同时处理两个方向
+    int64_t delta_ticks = static_cast<int64_t>(ticks - anchor.ticks);
+    int64_t wall_ns =
+            anchor.wall_ns + static_cast<int64_t>(delta_ticks * anchor.ns_per_tick);
+    wall->tv_sec = static_cast<time_t>(wall_ns / 1000000000);
+    wall->tv_nsec = static_cast<long>(wall_ns % 1000000000);
+}
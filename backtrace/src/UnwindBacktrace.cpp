@@ -30,34 +30,355 @@
 #include <pthread.h>
 #include <stdint.h>
 
+#include <atomic>
+#include <memory>
+#include <new>
 #include <string>
 #include <vector>
 #include "unwindstack/Error.h"
 
 #include <android-base/stringprintf.h>
+#include <bionic/pac.h>
 #include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineX86_64.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsArm64.h>
+#include <unwindstack/RegsX86_64.h>
 #include <unwindstack/Unwinder.h>
 
+#include "Symbolizer.h"
 #include "UnwindBacktrace.h"
+#include "debug_disable.h"
+
+// 开头属于 hook 自身的帧不记录.
+// 使用常量数组: hook 可能在本文件的全局对象构造之前被调用.
+static constexpr const char* kMapNamesToSkip[] = {"liballoc_hook.so"};
+// 回溯到这些函数时放弃本次记录
+static constexpr const char* kFunctionsToExit[] = {
+        "_Z24__init_additional_stacksP18pthread_internal_t",
+        "_Z25__allocate_thread_mappingmm"};
+
+unwindstack::AndroidLocalUnwinder& LocalUnwinder() {
+    [[clang::no_destroy]] static unwindstack::AndroidLocalUnwinder unwinder(
+            std::vector<std::string>(
+                    std::begin(kMapNamesToSkip), std::end(kMapNamesToSkip)),
+            {},
+            std::vector<std::string>(
+                    std::begin(kFunctionsToExit), std::end(kFunctionsToExit)));
+    return unwinder;
+}
+
+// 每个线程缓存上一次回溯的结果, 循环里的分配只需回溯到与上次重合的帧
+static bool g_unwind_cache_enabled = false;
+static pthread_key_t g_unwind_cache_key;
+
+// 缓存和其中的帧都放在工具内存池里, 不占用被测量的堆
+static const unwindstack::UnwindCacheMemory kUnwindCacheMemory = {
+        InternalArena::Allocate, InternalArena::Free};
+
+static void DeleteUnwindCache(void* cache) {
+    // 线程退出阶段, 释放不应再进入 hook
+    ScopedDisableDebugCalls disable;
+    static_cast<unwindstack::UnwindCache*>(cache)->~UnwindCache();
+    InternalArena::Free(cache, sizeof(unwindstack::UnwindCache));
+}
+
+void EnableUnwindCache() {
+    if (!g_unwind_cache_enabled &&
+        pthread_key_create(&g_unwind_cache_key, DeleteUnwindCache) == 0) {
+        g_unwind_cache_enabled = true;
+    }
+}
+
+static unwindstack::UnwindCache* ThreadUnwindCache() {
+    if (!g_unwind_cache_enabled) {
+        return nullptr;
+    }
+    auto* cache = static_cast<unwindstack::UnwindCache*>(
+            pthread_getspecific(g_unwind_cache_key));
+    if (__builtin_expect(cache == nullptr, 0)) {
+        cache = new (InternalArena::Allocate(sizeof(unwindstack::UnwindCache)))
+                unwindstack::UnwindCache(&kUnwindCacheMemory);
+        pthread_setspecific(g_unwind_cache_key, cache);
+    }
+    return cache;
+}
 
 unwindstack::ErrorCode Unwind(
-        std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frame_info,
+        InternalVector<uintptr_t>* frames, InternalVector<uint32_t>* map_ids,
         size_t max_frames) {
-    [[clang::no_destroy]] static unwindstack::AndroidLocalUnwinder unwinder(
-            std::vector<std::string>{"liballoc_hook.so"}, {},
-            std::vector<std::string>{
-                    "_Z24__init_additional_stacksP18pthread_internal_t",
-                    "_Z25__allocate_thread_mappingmm"});
     unwindstack::AndroidUnwinderData data(max_frames);
-    if (!unwinder.Unwind(data)) {
-        frames->clear();
-        frame_info->clear();
-    } else {
-        frames->resize(data.frames.size());
+    // 函数名留到 dump 时由 Symbolizer 解析
+    data.resolve_names = false;
+    data.cache = ThreadUnwindCache();
+    frames->clear();
+    map_ids->clear();
+    if (LocalUnwinder().Unwind(data)) {
         for (const auto& frame : data.frames) {
-            frames->at(frame.num) = frame.pc;
+            frames->push_back(frame.pc);
+            map_ids->push_back(Symbolizer::MapId(frame.map_info));
         }
-        *frame_info = std::move(data.frames);
     }
     return data.error.code;
 }
+
+#if defined(__aarch64__) || defined(__x86_64__)
+
+struct StackRange {
+    uintptr_t lo;
+    uintptr_t hi;
+};
+
+#if DEBUG_USE_PTHREAD_KEY_TLS
+// emutls 首次访问会经过被 hook 的 malloc, 改用 pthread key, 记录放在工具内存池里
+static pthread_key_t g_stack_range_key;
+static pthread_once_t g_stack_range_once = PTHREAD_ONCE_INIT;
+
+static void DeleteStackRange(void* range) {
+    InternalArena::Free(range, sizeof(StackRange));
+}
+
+static StackRange* ThreadStackRange() {
+    pthread_once(&g_stack_range_once, [] {
+        pthread_key_create(&g_stack_range_key, DeleteStackRange);
+    });
+    auto* range = static_cast<StackRange*>(pthread_getspecific(g_stack_range_key));
+    if (__builtin_expect(range == nullptr, 0)) {
+        range = new (InternalArena::Allocate(sizeof(StackRange))) StackRange{0, 0};
+        pthread_setspecific(g_stack_range_key, range);
+    }
+    return range;
+}
+#else
+static DEBUG_TLS StackRange g_stack_range = {0, 0};
+
+static inline StackRange* ThreadStackRange() {
+    return &g_stack_range;
+}
+#endif
+
+// 当前线程栈的地址范围, 首次查询后缓存在线程局部的记录中
+static bool GetThreadStack(uintptr_t* lo, uintptr_t* hi) {
+    StackRange* range = ThreadStackRange();
+    if (__builtin_expect(range->hi == 0, 0)) {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return false;
+        }
+        void* addr;
+        size_t size;
+        int ret = pthread_attr_getstack(&attr, &addr, &size);
+        pthread_attr_destroy(&attr);
+        if (ret != 0) {
+            return false;
+        }
+        range->lo = reinterpret_cast<uintptr_t>(addr);
+        range->hi = range->lo + size;
+    }
+    *lo = range->lo;
+    *hi = range->hi;
+    return true;
+}
+
+static inline uint64_t& FramePointerReg(unwindstack::Regs* regs) {
+#if defined(__aarch64__)
+    return (*static_cast<unwindstack::RegsArm64*>(regs))[unwindstack::ARM64_REG_R29];
+#else
+    return (*static_cast<unwindstack::RegsX86_64*>(regs))[unwindstack::X86_64_REG_RBP];
+#endif
+}
+
+// 用 DWARF CFI 把 regs 从当前帧回退到调用者, regs 中的 pc 是返回地址
+static bool DwarfStep(unwindstack::Regs* regs, bool* finished) {
+    auto& unwinder = LocalUnwinder();
+    std::shared_ptr<unwindstack::MapInfo> map_info =
+            unwinder.GetMaps()->Find(regs->pc());
+    if (map_info == nullptr) {
+        return false;
+    }
+    unwindstack::Memory* memory = unwinder.GetProcessMemory().get();
+    unwindstack::Elf* elf = map_info->GetElf(
+            unwinder.GetProcessMemory(), unwindstack::Regs::CurrentArch());
+    uint64_t rel_pc = elf->GetRelPc(regs->pc(), map_info.get());
+    if (elf->StepIfSignalHandler(rel_pc, regs, memory)) {
+        return true;
+    }
+    bool is_signal_frame = false;
+    rel_pc -=
+            unwindstack::GetPcAdjustment(rel_pc, elf, unwindstack::Regs::CurrentArch());
+    return elf->Step(rel_pc, regs, memory, finished, &is_signal_frame);
+}
+
+// 以返回地址为键记录 "所在函数维护了帧指针" 的判定, 命中时不再强制 DWARF 回退.
+// 直接映射, 并发覆盖只会让判定失效, 不影响正确性.
+static constexpr size_t kFramePointerPcSlots = 1024;
+static std::atomic<uintptr_t> g_frame_pointer_pcs[kFramePointerPcSlots];
+
+static inline std::atomic<uintptr_t>& FramePointerPcSlot(uintptr_t pc) {
+    return g_frame_pointer_pcs[(pc * 0x9e3779b97f4a7c15ULL) >> 54];
+}
+
+// 沿帧记录 {上一级 fp, 返回地址} 回溯. 每个 fp 都要求对齐, 位于线程栈内,
+// 且高于上一帧. 校验失败说明该帧没有维护帧指针, 只对这一帧用 DWARF 回退,
+// 得到的 fp 重新有效后继续走帧链. 输出与 Unwind() 相同: 跳过开头的 hook 帧,
+// pc 为减去指令长度调整后的值.
+unwindstack::ErrorCode FramePointerUnwind(
+        InternalVector<uintptr_t>* frames, InternalVector<uint32_t>* map_ids,
+        size_t max_frames) {
+    auto& unwinder = LocalUnwinder();
+    const unwindstack::UnwindFilter& filter = unwinder.filter();
+    unwindstack::ErrorData error{unwindstack::ERROR_NONE, 0};
+    if (!unwinder.Initialize(error)) {
+        frames->clear();
+        map_ids->clear();
+        return error.code;
+    }
+
+    uintptr_t stack_lo;
+    uintptr_t stack_hi;
+    uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    // 运行在 sigaltstack 等线程栈以外的栈上时无法校验帧指针
+    if (!GetThreadStack(&stack_lo, &stack_hi) || fp < stack_lo || fp >= stack_hi) {
+        return Unwind(frames, map_ids, max_frames);
+    }
+    auto valid_fp = [stack_hi](uintptr_t addr, uintptr_t low) {
+        return (addr & (sizeof(uintptr_t) - 1)) == 0 && addr >= low &&
+               addr <= stack_hi - 2 * sizeof(uintptr_t);
+    };
+
+    frames->clear();
+    map_ids->clear();
+    unwindstack::ErrorCode code = unwindstack::ERROR_NONE;
+    std::unique_ptr<unwindstack::Regs> regs;
+    // regs 是否描述当前帧. 为 false 时当前帧只有帧链上的 pc 和 fp
+    bool regs_current = false;
+    // 当前帧的返回地址, 0 表示本函数自身的帧
+    uintptr_t pc = 0;
+    // 产生当前帧的帧记录, 帧链断开时从这里重建寄存器
+    uintptr_t prev_pc = 0;
+    uintptr_t prev_fp = 0;
+    // 调用者的帧记录只能位于更高的地址
+    uintptr_t low = fp;
+    bool skipping = true;
+    bool force_dwarf = false;
+    uintptr_t verify_pc = 0;
+    uintptr_t verify_fp = 0;
+    while (true) {
+        if (pc != 0) {
+            std::shared_ptr<unwindstack::MapInfo> map_info =
+                    unwinder.GetMaps()->Find(pc);
+            uint32_t map_flags =
+                    map_info != nullptr ? filter.MapFlags(map_info.get()) : 0;
+            if (skipping) {
+                skipping = map_flags & unwindstack::UnwindFilter::kSkipMap;
+                // 直接调用 malloc 的多是 operator new, strdup 等系统库里的封装,
+                // 它们通常不维护帧指针, 帧链上看不出断开, 但会丢掉其调用者.
+                // 这一帧先用 DWARF 回退, 与帧链结果一致时记下, 之后直接走帧链.
+                if (!skipping &&
+                    FramePointerPcSlot(pc).load(std::memory_order_relaxed) != pc) {
+                    force_dwarf = true;
+                    verify_pc = pc;
+                    verify_fp = valid_fp(fp, low) ? fp : 0;
+                }
+            }
+            if (!skipping) {
+                if (map_flags & unwindstack::UnwindFilter::kStopMap) {
+                    break;
+                }
+                if (frames->size() == max_frames) {
+                    code = unwindstack::ERROR_MAX_FRAMES_EXCEEDED;
+                    break;
+                }
+                if (map_info == nullptr) {
+                    frames->push_back(pc);
+                    map_ids->push_back(0);
+                    code = unwindstack::ERROR_INVALID_MAP;
+                    break;
+                }
+                unwindstack::Elf* elf = map_info->GetElf(
+                        unwinder.GetProcessMemory(), unwindstack::Regs::CurrentArch());
+                uint64_t rel_pc = elf->GetRelPc(pc, map_info.get());
+                uint64_t adjust = unwindstack::GetPcAdjustment(
+                        rel_pc, elf, unwindstack::Regs::CurrentArch());
+                frames->push_back(pc - adjust);
+                map_ids->push_back(Symbolizer::MapId(map_info));
+                // 不解析函数名, 按预先解析的符号地址范围判断
+                if (filter.InExitFunction(map_info.get(), elf, rel_pc - adjust)) {
+                    code = unwindstack::ERROR_EXIT_FUNC;
+                    break;
+                }
+            }
+        }
+
+        if (!regs_current && !force_dwarf && valid_fp(fp, low)) {
+            const uintptr_t* record = reinterpret_cast<const uintptr_t*>(fp);
+            prev_pc = pc;
+            prev_fp = fp;
+            low = fp + 2 * sizeof(uintptr_t);
+            fp = record[0];
+            pc = __bionic_clear_pac_bits(record[1]);
+        } else {
+            if (!regs_current) {
+                // fp 为 0 是帧链正常结束
+                if (fp == 0 && !force_dwarf) {
+                    break;
+                }
+                force_dwarf = false;
+                if (prev_pc == 0) {
+                    return Unwind(frames, map_ids, max_frames);
+                }
+                // 从上一帧的帧记录重建寄存器并回退一次, 得到当前帧准确的 sp.
+                // 带帧指针的函数 CFA 由 fp 计算, sp 只是近似值.
+                if (regs == nullptr) {
+                    regs.reset(unwindstack::Regs::CreateFromLocal());
+                    unwinder.GetProcessMemory()->Clear();
+                }
+                regs->set_pc(prev_pc);
+                regs->set_sp(prev_fp);
+                FramePointerReg(regs.get()) = prev_fp;
+                bool finished = false;
+                if (!DwarfStep(regs.get(), &finished) ||
+                    __bionic_clear_pac_bits(regs->pc()) != pc) {
+                    return Unwind(frames, map_ids, max_frames);
+                }
+                regs_current = true;
+            }
+            bool finished = false;
+            if (!DwarfStep(regs.get(), &finished) || finished) {
+                break;
+            }
+            pc = __bionic_clear_pac_bits(regs->pc());
+            low = regs->sp();
+            fp = FramePointerReg(regs.get());
+            if (verify_pc != 0) {
+                const uintptr_t* record = reinterpret_cast<const uintptr_t*>(verify_fp);
+                if (record != nullptr && record[0] == fp &&
+                    __bionic_clear_pac_bits(record[1]) == pc) {
+                    FramePointerPcSlot(verify_pc).store(
+                            verify_pc, std::memory_order_relaxed);
+                }
+                verify_pc = 0;
+            }
+            // 调用者重新维护了帧指针, 回到帧链
+            regs_current = !valid_fp(fp, low);
+        }
+        if (pc == 0) {
+            break;
+        }
+    }
+    return code;
+}
+
+#else
+
+unwindstack::ErrorCode FramePointerUnwind(
+        InternalVector<uintptr_t>* frames, InternalVector<uint32_t>* map_ids,
+        size_t max_frames) {
+    return Unwind(frames, map_ids, max_frames);
+}
+
+#endif
@@ -2,10 +2,13 @@
 
 #include "debug_disable.h"
 
+#if DEBUG_USE_PTHREAD_KEY_TLS
 pthread_key_t g_disable_key;
+// key 创建之前 (进程启动早期) pthread_getspecific 的结果不可信, 视为未禁用
+static bool g_disable_key_valid = false;
 
 bool DebugCallsDisabled() {
-    if (pthread_getspecific(g_disable_key) != nullptr) {
+    if (g_disable_key_valid && pthread_getspecific(g_disable_key) != nullptr) {
         return true;
     }
     return false;
@@ -17,18 +20,33 @@ bool DebugDisableInitialize() {
         return false;
     }
     pthread_setspecific(g_disable_key, nullptr);
+    g_disable_key_valid = true;
 
     return true;
 }
 
 void DebugDisableFinalize() {
+    g_disable_key_valid = false;
     pthread_key_delete(g_disable_key);
 }
 
 void DebugDisableSet(bool disable) {
+    if (!g_disable_key_valid) {
+        return;
+    }
     if (disable) {
         pthread_setspecific(g_disable_key, reinterpret_cast<void*>(1));
     } else {
         pthread_setspecific(g_disable_key, nullptr);
     }
 }
+#else
+DEBUG_TLS bool g_debug_calls_disabled = false;
+
+bool DebugDisableInitialize() {
+    g_debug_calls_disabled = false;
+    return true;
+}
+
+void DebugDisableFinalize() {}
+#endif
@@ -1,60 +1,101 @@
+#include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <sys/mman.h>
 #include <sys/param.h>  // powerof2 ---> ((((x) - 1) & (x)) == 0)
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <android-base/stringprintf.h>
+#include <cerrno>
 #include <cstring>
-#include <filesystem>
-#include <fstream>
 #include <string>
-#include <unordered_set>
 
 #include "Config.h"
 #include "DebugData.h"
+#include "HeapDumper.h"
+#include "IoctlClassifier.h"
 #include "PointerData.h"
+#include "ScopedConcurrentLock.h"
 #include "debug_disable.h"
 #include "malloc_debug.h"
 
-#include "ion/ion.h"
-#include "ion/ion_4.19.h"
-#include "midgard/mali_kbase_ioctl.h"
-#include "msm_ksgl/msm_ksgl.h"
-
 #include "memory_hook.h"
 
-class ScopedConcurrentLock {
-public:
-    ScopedConcurrentLock() { pthread_rwlock_rdlock(&lock_); }
-    ~ScopedConcurrentLock() { pthread_rwlock_unlock(&lock_); }
+DebugData* g_debug;
 
-    static void Init() {
-        pthread_rwlockattr_t attr;
-        // Set the attribute so that when a write lock is pending, read locks are no
-        // longer granted.
-#if __ANDROID_API__ >= 23
-        pthread_rwlockattr_setkind_np(
-                &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
-#endif
-        pthread_rwlock_init(&lock_, &attr);
+// 调用者必须已经 BlockAllOperations 并关闭 debug 调用
+static DumpSnapshot* SnapshotHeapBlocked() {
+    if (g_debug->TrackPointers()) {
+        g_debug->pointer->DrainAllRings();
     }
 
-    static void BlockAllOperations() { pthread_rwlock_wrlock(&lock_); }
-
-private:
-    static pthread_rwlock_t lock_;
-};
-pthread_rwlock_t ScopedConcurrentLock::lock_;
+    DumpSnapshot* snapshot = HeapDumper::NewSnapshot();
+    g_debug->pointer->Snapshot(snapshot);
+    return snapshot;
+}
 
-DebugData* g_debug;
+// 信号处理函数只向管道写一个字节, dump 由专门的控制线程完成, 被打断的线程立即返回.
+// 没有用 signalfd: 它要求进程内所有线程都屏蔽该信号, 预加载库管不到应用之后
+// 创建的线程, 也管不到应用自己修改的信号屏蔽字.
+static int g_signal_pipe[2] = {-1, -1};
 
 static void singal_dump_heap(int) {
-    if ((g_debug->config().options() & BACKTRACE)) {
-        debug_dump_heap(android::base::StringPrintf(
-                                "%s.time.%ld.txt",
-                                g_debug->config().backtrace_dump_prefix(), time(NULL))
-                                .c_str());
+    int saved_errno = errno;
+    char request = 0;
+    // 写端非阻塞, 管道满说明已有未处理的请求, 丢弃即可
+    write(g_signal_pipe[1], &request, 1);
+    errno = saved_errno;
+}
+
+static void* SignalControlMain(void* data) {
+    int read_fd = static_cast<int>(reinterpret_cast<intptr_t>(data));
+    DebugDisableSet(true);
+
+    char requests[64];
+    while (true) {
+        ssize_t count = read(read_fd, requests, sizeof(requests));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        if (!(g_debug->config().options() & BACKTRACE)) {
+            continue;
+        }
+        // 一次读到的多个请求合并为一次 dump
+        debug_dump_heap(
+                android::base::StringPrintf(
+                        "%s.time.%ld.txt", g_debug->config().backtrace_dump_prefix(),
+                        time(NULL))
+                        .c_str(),
+                true);
+    }
+    return nullptr;
+}
+
+static bool StartSignalControl() {
+    if (pipe2(g_signal_pipe, O_CLOEXEC) != 0) {
+        return false;
     }
+    fcntl(g_signal_pipe[1], F_SETFL, O_NONBLOCK);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int error = pthread_create(
+            &thread, &attr, SignalControlMain,
+            reinterpret_cast<void*>(static_cast<intptr_t>(g_signal_pipe[0])));
+    pthread_attr_destroy(&attr);
+    if (error != 0) {
+        close(g_signal_pipe[0]);
+        close(g_signal_pipe[1]);
+        g_signal_pipe[0] = g_signal_pipe[1] = -1;
+        return false;
+    }
+    return true;
 }
 
 bool debug_initialize(void* init_space[]) {
@@ -70,8 +111,20 @@ bool debug_initialize(void* init_space[]) {
     g_debug = debug;
 
     ScopedConcurrentLock::Init();
+    HeapDumper::Initialize();
 
     if (g_debug->config().options() & DUMP_ON_SINGAL) {
+        if (!StartSignalControl()) {
+            return false;
+        }
+        // 子进程与父进程共用继承来的管道, 信号会被父进程的控制线程读走,
+        // 需要新建管道并重新启动控制线程
+        pthread_atfork(nullptr, nullptr, [] {
+            close(g_signal_pipe[0]);
+            close(g_signal_pipe[1]);
+            StartSignalControl();
+        });
+
         struct sigaction enable_act = {};
         enable_act.sa_handler = singal_dump_heap;
         enable_act.sa_flags = SA_RESTART | SA_ONSTACK;
@@ -97,12 +150,22 @@ void debug_finalize() {
     // Turn off capturing allocations calls.
     DebugDisableSet(true);
 
+    if (g_debug->TrackPointers()) {
+        // 剩余的记录在当前线程消费, 峰值统计同样需要所有线程的记录
+        g_debug->pointer->StopAggregator();
+        g_debug->pointer->DrainAllRings();
+    }
+
     if ((g_debug->config().options() & BACKTRACE) &&
         g_debug->config().backtrace_dump_on_exit()) {
-        debug_dump_heap(android::base::StringPrintf(
-                                "%s.exit.%ld.txt",
-                                g_debug->config().backtrace_dump_prefix(), time(NULL))
-                                .c_str());
+        // 先等之前异步触发的 dump 写完, 退出时的 dump 直接在当前线程写
+        HeapDumper::Flush();
+        HeapDumper::Write(
+                android::base::StringPrintf(
+                        "%s.exit.%ld.txt", g_debug->config().backtrace_dump_prefix(),
+                        time(NULL))
+                        .c_str(),
+                SnapshotHeapBlocked());
     }
 
     if (g_debug->TrackPointers()) {
@@ -114,17 +177,16 @@ void debug_finalize() {
     // g_debug、pthread 键等.
 }
 
-void debug_dump_heap(const char* file_name) {
-    ScopedConcurrentLock lock;
+void debug_dump_heap(const char* file_name, bool wait) {
     ScopedDisableDebugCalls disable;
 
-    int fd = open(file_name, O_RDWR | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0644);
-    if (fd == -1) {
-        return;
-    }
+    // 快照前要消费所有线程队列中的记录, 需要其它线程都不在 hook 内.
+    // 只在复制汇总表期间阻塞, 符号化和写文件交给 dump 线程.
+    ScopedConcurrentLock::BlockAllOperations();
+    DumpSnapshot* snapshot = SnapshotHeapBlocked();
+    ScopedConcurrentLock::UnblockAllOperations();
 
-    g_debug->pointer->DumpLiveToFile(fd);
-    close(fd);
+    HeapDumper::Submit(file_name, snapshot, wait);
 }
 
 static void* InternalMalloc(size_t size) {
@@ -264,67 +326,158 @@ int debug_posix_memalign(void** memptr, size_t alignment, size_t size) {
     return (*memptr != nullptr) ? 0 : ENOMEM;
 }
 
-namespace DMA_BUF {
+// Mali 的分配以 4K 页为单位
+static constexpr int kMaliPageShift = 12;
 
-int parse_inode(const char* __s) {
-    const char* colon_pos = strchr(__s, ':');
-    int val = 0;
-    if (colon_pos != NULL) {
-        colon_pos++;
-        val = atoi(colon_pos);
-    }
-    return val;
+// 读取调用者传给 ioctl 的内存. 此时内核还没有检查过 arg, 指针非法时应由 ioctl
+// 返回 EFAULT, 而不是在工具里崩溃. process_vm_readv 读自身进程, 地址无效时只返回错误
+static bool ReadCallerMemory(const void* addr, void* out, size_t size) {
+    struct iovec local = {out, size};
+    struct iovec remote = {const_cast<void*>(addr), size};
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) ==
+           static_cast<ssize_t>(size);
 }
 
-static bool is_dma_buf(int fd) {
-    std::filesystem::path path = "/proc/self/fdinfo/" + std::to_string(fd);
-    std::ifstream file(path);
-    if (!file.is_open())
+// Mali 分配的参数和返回值共用一个 union, 返回的 gpu_va 会覆盖 commit_pages,
+// 所以提交的大小要在调用前取出. 其它请求大小为 0. 读取失败时返回 false
+static bool ReadMaliCommitSize(unsigned int request, void* arg, size_t* size) {
+    const __u64* commit_pages;
+    switch (request) {
+        case KBASE_IOCTL_MEM_ALLOC:
+            commit_pages = &static_cast<kbase_ioctl_mem_alloc*>(arg)->in.commit_pages;
+            break;
+        case KBASE_IOCTL_MEM_ALLOC_EX:
+            commit_pages =
+                    &static_cast<kbase_ioctl_mem_alloc_ex*>(arg)->in.commit_pages;
+            break;
+        default:
+            *size = 0;
+            return true;
+    }
+    __u64 pages;
+    if (!ReadCallerMemory(commit_pages, &pages, sizeof(pages))) {
         return false;
+    }
+    *size = pages << kMaliPageShift;
+    return true;
+}
 
-    static std::unordered_set<int> inode_set;
-    std::string line;
-    int inode = -1;
-    while (std::getline(file, line)) {
-        if (line.find("ino:") == 0) {
-            inode = parse_inode(line.c_str());
+// 分配和释放类 ioctl 成功后, 从参数或返回值中取出句柄、新 fd 和大小, 在分配时登记.
+// 导出的 dma-buf fd 之后的 mmap 由 DmaBufTable 识别, 不会重复计入.
+// 这里解析的请求要与 IsTrackedIoctl 保持一致.
+static void TrackAllocIoctl(
+        int fd, unsigned int request, void* arg, int result, size_t mali_size) {
+    switch (request) {
+        case DMA_HEAP_IOCTL_ALLOC: {
+            auto* data = static_cast<dma_heap_allocation_data*>(arg);
+            g_debug->dma_bufs.AddExported(data->fd, data->len);
+            break;
         }
-
-        if (line.find("exp_name:") == 0 && inode > 0) {
-            if (inode_set.count(inode)) {
-                return false;
+        case ION_IOC_NEW_ALLOC: {
+            auto* data = static_cast<ion_new_allocation_data*>(arg);
+            g_debug->dma_bufs.AddExported(data->fd, data->len);
+            break;
+        }
+        // 旧版 ION 先分配 handle, 再为 handle 导出 fd. 已登记的 handle 导出的 fd
+        // 只跟踪生命周期, 字节数由 handle 计入
+        case ION_IOC_ALLOC: {
+            auto* data = static_cast<ion_allocation_data*>(arg);
+            g_debug->gpu_handles.Add(
+                    GpuHandleKey{fd, kIonDriver, static_cast<uint64_t>(data->handle)},
+                    data->len, DMA);
+            break;
+        }
+        case ION_IOC_FREE: {
+            auto* data = static_cast<ion_handle_data*>(arg);
+            g_debug->gpu_handles.Remove(
+                    GpuHandleKey{fd, kIonDriver, static_cast<uint64_t>(data->handle)});
+            break;
+        }
+        case ION_IOC_SHARE:
+        case ION_IOC_MAP: {
+            auto* data = static_cast<ion_fd_data*>(arg);
+            bool has_handle = g_debug->gpu_handles.Contains(
+                    GpuHandleKey{fd, kIonDriver, static_cast<uint64_t>(data->handle)});
+            g_debug->dma_bufs.AddExported(data->fd, 0, !has_handle);
+            break;
+        }
+        case UDMABUF_CREATE: {
+            auto* data = static_cast<udmabuf_create*>(arg);
+            g_debug->dma_bufs.AddExported(result, data->size);
+            break;
+        }
+        case UDMABUF_CREATE_LIST: {
+            auto* data = static_cast<udmabuf_create_list*>(arg);
+            size_t size = 0;
+            for (uint32_t i = 0; i < data->count; i++) {
+                size += data->list[i].size;
             }
-            inode_set.emplace(inode);
-            return true;
+            g_debug->dma_bufs.AddExported(result, size);
+            break;
+        }
+        // Mali: 以 gpu_va 为句柄
+        case KBASE_IOCTL_MEM_ALLOC: {
+            auto* data = static_cast<kbase_ioctl_mem_alloc*>(arg);
+            g_debug->gpu_handles.Add(
+                    GpuHandleKey{fd, kMaliDriver, data->out.gpu_va}, mali_size, GPU);
+            break;
+        }
+        case KBASE_IOCTL_MEM_ALLOC_EX: {
+            auto* data = static_cast<kbase_ioctl_mem_alloc_ex*>(arg);
+            g_debug->gpu_handles.Add(
+                    GpuHandleKey{fd, kMaliDriver, data->out.gpu_va}, mali_size, GPU);
+            break;
+        }
+        case KBASE_IOCTL_MEM_FREE: {
+            auto* data = static_cast<kbase_ioctl_mem_free*>(arg);
+            g_debug->gpu_handles.Remove(GpuHandleKey{fd, kMaliDriver, data->gpu_addr});
+            break;
+        }
+        // KGSL: 以 id 为句柄
+        case IOCTL_KGSL_GPUOBJ_ALLOC: {
+            auto* data = static_cast<kgsl_gpuobj_alloc*>(arg);
+            g_debug->gpu_handles.Add(
+                    GpuHandleKey{fd, kKgslDriver, data->id}, data->size, GPU);
+            break;
+        }
+        case IOCTL_KGSL_GPUMEM_ALLOC_ID: {
+            auto* data = static_cast<kgsl_gpumem_alloc_id*>(arg);
+            g_debug->gpu_handles.Add(
+                    GpuHandleKey{fd, kKgslDriver, data->id}, data->size, GPU);
+            break;
         }
+        // 延迟到事件发生时释放的对象也按现在释放处理
+        case IOCTL_KGSL_GPUOBJ_FREE: {
+            auto* data = static_cast<kgsl_gpuobj_free*>(arg);
+            g_debug->gpu_handles.Remove(GpuHandleKey{fd, kKgslDriver, data->id});
+            break;
+        }
+        case IOCTL_KGSL_GPUMEM_FREE_ID: {
+            auto* data = static_cast<kgsl_gpumem_free_id*>(arg);
+            g_debug->gpu_handles.Remove(GpuHandleKey{fd, kKgslDriver, data->id});
+            break;
+        }
+        default:
+            break;
     }
-    return false;
 }
 
-}  // namespace DMA_BUF
-
-static thread_local bool gpu_ioctl_alloc = false;  // TLS to store a unique flag per thread
-
 int debug_ioctl(int fd, unsigned int request, void* arg) {
-    if (DebugCallsDisabled()) {
+    if (!IsTrackedIoctl(request) || DebugCallsDisabled()) {
         return (int)syscall(SYS_ioctl, fd, request, arg);
     }
 
     ScopedConcurrentLock lock;
     ScopedDisableDebugCalls disable;
 
-    static std::unordered_set<unsigned int> req_set = {
-        KBASE_IOCTL_MEM_ALLOC_EX,
-        KBASE_IOCTL_MEM_ALLOC,
-        IOCTL_KGSL_GPUOBJ_ALLOC,
-        ION_IOC_NEW_ALLOC
-    };
-
-    if (req_set.count(request)) {
-        gpu_ioctl_alloc = true;  // Only the calling thread will set this to true
+    // 参数读不出来时照常转发, 由内核报告错误, 本次不跟踪
+    size_t mali_size;
+    bool readable = ReadMaliCommitSize(request, arg, &mali_size);
+    int result = (int)syscall(SYS_ioctl, fd, request, arg);
+    if (readable && result >= 0 && g_debug->TrackPointers()) {
+        TrackAllocIoctl(fd, request, arg, result, mali_size);
     }
-
-    return (int)syscall(SYS_ioctl, fd, request, arg);
+    return result;
 }
 
 void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset) {
@@ -337,14 +490,16 @@ void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t o
 
     if (size > PointerInfoType::MaxSize()) {
         errno = ENOMEM;
-        return nullptr;
+        return MAP_FAILED;
     }
 
     void* result = (void*)syscall(SYS_mmap, addr, size, prot, flags, fd, offset);
 
-    if (g_debug->TrackPointers() && gpu_ioctl_alloc) {
-        gpu_ioctl_alloc = false;  // Reset the flag immediately after processing
-        g_debug->pointer->Add(result, size, DMA);
+    if (g_debug->TrackPointers() && fd >= 0 && result != MAP_FAILED) {
+        // dma-buf 和 GPU 分配在分配时已经计入, 映射只用来跟踪它们的生命周期
+        if (!g_debug->dma_bufs.Map(fd, result)) {
+            g_debug->gpu_handles.MapCookie(fd, offset, result);
+        }
     }
 
     return result;
@@ -360,19 +515,15 @@ void* debug_mmap(void* addr, size_t size, int prot, int flags, int fd, off_t off
 
     if (size > PointerInfoType::MaxSize()) {
         errno = ENOMEM;
-        return nullptr;
+        return MAP_FAILED;
     }
 
     void* result = (void*)syscall(SYS_mmap, addr, size, prot, flags, fd, offset);
     if (g_debug->TrackPointers()) {
         if (fd < 0)
             g_debug->pointer->Add(result, size, MMAP);
-        else if (DMA_BUF::is_dma_buf(fd))
-            g_debug->pointer->Add(result, size, DMA);
-        else if (gpu_ioctl_alloc) {
-            gpu_ioctl_alloc = false;  // Reset the flag immediately after processing
-            g_debug->pointer->Add(result, size, DMA);
-        }
+        else if (result != MAP_FAILED && !g_debug->dma_bufs.Map(fd, result))
+            g_debug->gpu_handles.MapCookie(fd, offset, result);
     }
 
     return result;
@@ -388,7 +539,91 @@ int debug_munmap(void* addr, size_t size) {
 
     if (g_debug->TrackPointers()) {
         g_debug->pointer->Remove(addr);
+        g_debug->dma_bufs.Unmap(addr);
+        g_debug->gpu_handles.Unmap(addr);
     }
 
     return (int)syscall(SYS_munmap, addr, size);
 }
+
+// 以下 fd 相关的 hook 只有在 fd 可能引用已知 dma-buf 或带有分配的 GPU 设备时才会被调用,
+// 见 alloc_hook.cpp. 内核无论成败都会释放 close 的 fd, dup 类调用成功后目标 fd
+// 原先引用的文件已被关闭.
+int debug_close(int fd) {
+    if (DebugCallsDisabled()) {
+        return SysClose(fd);
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    g_debug->dma_bufs.CloseFd(fd);
+    g_debug->gpu_handles.CloseFd(fd);
+    return SysClose(fd);
+}
+
+int debug_dup(int fd) {
+    if (DebugCallsDisabled()) {
+        return SysDup(fd);
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    int result = SysDup(fd);
+    if (result >= 0) {
+        g_debug->dma_bufs.DupFd(fd, result);
+    }
+    return result;
+}
+
+int debug_dup2(int old_fd, int new_fd) {
+    if (DebugCallsDisabled()) {
+        return SysDup2(old_fd, new_fd);
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    int result = SysDup2(old_fd, new_fd);
+    if (result >= 0) {
+        if (old_fd != new_fd) {
+            g_debug->gpu_handles.CloseFd(new_fd);
+        }
+        g_debug->dma_bufs.DupFd(old_fd, result);
+    }
+    return result;
+}
+
+int debug_dup3(int old_fd, int new_fd, int flags) {
+    if (DebugCallsDisabled()) {
+        return SysDup3(old_fd, new_fd, flags);
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    int result = SysDup3(old_fd, new_fd, flags);
+    if (result >= 0) {
+        if (old_fd != new_fd) {
+            g_debug->gpu_handles.CloseFd(new_fd);
+        }
+        g_debug->dma_bufs.DupFd(old_fd, result);
+    }
+    return result;
+}
+
+int debug_fcntl(int fd, int cmd, void* arg) {
+    if (DebugCallsDisabled()) {
+        return SysFcntl(fd, cmd, arg);
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    int result = SysFcntl(fd, cmd, arg);
+    if (result >= 0 && (cmd == F_DUPFD || cmd == F_DUPFD_CLOEXEC)) {
+        g_debug->dma_bufs.DupFd(fd, result);
+    }
+    return result;
+}
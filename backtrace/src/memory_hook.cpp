@@ -1,3 +1,8 @@
+#include <dlfcn.h>
+#include <sched.h>
+#include <cstdint>
+#include <cstring>
+
 #include "memory_hook.h"
 
 void* (*m_sys_malloc)(size_t) = nullptr;
@@ -5,4 +10,109 @@ void (*m_sys_free)(void*) = nullptr;
 void* (*m_sys_calloc)(size_t, size_t) = nullptr;
 void* (*m_sys_realloc)(void*, size_t) = nullptr;
 void* (*m_sys_memalign)(size_t, size_t) = nullptr;
-int (*m_sys_posix_memalign)(void**, size_t, size_t) = nullptr;
\ No newline at end of file
+int (*m_sys_posix_memalign)(void**, size_t, size_t) = nullptr;
+
+int (*m_sys_close)(int) = nullptr;
+int (*m_sys_dup)(int) = nullptr;
+int (*m_sys_dup2)(int, int) = nullptr;
+int (*m_sys_dup3)(int, int, int) = nullptr;
+int (*m_sys_fcntl)(int, int, ...) = nullptr;
+
+std::atomic<int> g_sys_allocator_state{kSysAllocatorUnresolved};
+
+// glibc 的 dlsym 会为 dlerror 状态等申请少量内存, 64KB 足够
+static constexpr size_t kBootstrapArenaSize = 64 * 1024;
+static constexpr size_t kBootstrapAlign = 16;
+alignas(kBootstrapAlign) static char g_bootstrap_arena[kBootstrapArenaSize];
+static std::atomic<size_t> g_bootstrap_used{0};
+
+template <typename T>
+static void ResolveSymbol(void* handle, const char* name, T* func) {
+    void* addr = dlsym(handle, name);
+    if (addr != nullptr) {
+        *func = reinterpret_cast<T>(addr);
+    }
+}
+
+bool ResolveSysAllocator() {
+    int expected = kSysAllocatorUnresolved;
+    if (!g_sys_allocator_state.compare_exchange_strong(
+                expected, kSysAllocatorResolving, std::memory_order_acquire)) {
+        return expected == kSysAllocatorReady;
+    }
+
+#ifdef RTLD_NEXT
+    // glibc 的 libc.so 是链接脚本, dlopen 会失败, 直接取 hook 库之后的下一个定义
+    void* handle = RTLD_NEXT;
+#else
+    void* handle = dlopen("libc.so", RTLD_LAZY);
+#endif
+    ResolveSymbol(handle, "malloc", &m_sys_malloc);
+    ResolveSymbol(handle, "free", &m_sys_free);
+    ResolveSymbol(handle, "calloc", &m_sys_calloc);
+    ResolveSymbol(handle, "realloc", &m_sys_realloc);
+    ResolveSymbol(handle, "memalign", &m_sys_memalign);
+    ResolveSymbol(handle, "posix_memalign", &m_sys_posix_memalign);
+    ResolveSymbol(handle, "close", &m_sys_close);
+    ResolveSymbol(handle, "dup", &m_sys_dup);
+    ResolveSymbol(handle, "dup2", &m_sys_dup2);
+    ResolveSymbol(handle, "dup3", &m_sys_dup3);
+    ResolveSymbol(handle, "fcntl", &m_sys_fcntl);
+#ifndef RTLD_NEXT
+    if (handle != nullptr) {
+        dlclose(handle);
+    }
+#endif
+
+    g_sys_allocator_state.store(kSysAllocatorReady, std::memory_order_release);
+    return true;
+}
+
+void* BootstrapMalloc(size_t size) {
+    // 先拒绝超过 arena 的请求, 下面加上块头和对齐后不会回绕
+    if (size > kBootstrapArenaSize) {
+        return nullptr;
+    }
+    // 每块前面预留一个对齐单位存放大小, realloc 时需要拷贝
+    size_t total =
+            kBootstrapAlign + ((size + kBootstrapAlign - 1) & ~(kBootstrapAlign - 1));
+    size_t offset = g_bootstrap_used.fetch_add(total, std::memory_order_relaxed);
+    if (offset + total > kBootstrapArenaSize) {
+        return nullptr;
+    }
+    char* block = g_bootstrap_arena + offset + kBootstrapAlign;
+    reinterpret_cast<size_t*>(block)[-1] = size;
+    return block;
+}
+
+void* BootstrapCalloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        return nullptr;
+    }
+    // 静态 arena 初始为 0 且从不复用, 无需再清零
+    return BootstrapMalloc(total);
+}
+
+void* BootstrapRealloc(void* ptr, size_t size) {
+    if (ptr != nullptr && !IsBootstrapPointer(ptr)) {
+        // 不是 bootstrap arena 分配的块没有大小头, 只能交给系统 realloc.
+        // 解析完成之前 hook 不会从系统分配, 这样的块不在跟踪范围内
+        while (!SysAllocatorReady()) {
+            sched_yield();
+        }
+        return m_sys_realloc(ptr, size);
+    }
+    void* result = SysAllocatorReady() ? m_sys_malloc(size) : BootstrapMalloc(size);
+    if (result != nullptr && ptr != nullptr) {
+        size_t old_size = reinterpret_cast<size_t*>(ptr)[-1];
+        memcpy(result, ptr, old_size < size ? old_size : size);
+    }
+    return result;
+}
+
+bool IsBootstrapPointer(const void* ptr) {
+    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(g_bootstrap_arena);
+    return addr - begin < kBootstrapArenaSize;
+}
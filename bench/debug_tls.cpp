@@ -0,0 +1,68 @@
+// 重入保护的单次开销: 每次 hook 调用要检查一次是否已禁用, 再用 ScopedDisableDebugCalls
+// 设置和清除标记. 对比 pthread_getspecific/pthread_setspecific 的实现和
+// 工具当前的 DEBUG_TLS 实现 (initial-exec 的 __thread, API 29 之前的 bionic 上仍是
+// pthread key).
+//   ./debug_tls [次数]
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "debug_disable.h"
+
+static pthread_key_t g_key;
+
+static inline bool KeyDisabled() {
+    return pthread_getspecific(g_key) != nullptr;
+}
+
+static inline void KeyDisableSet(bool disable) {
+    pthread_setspecific(g_key, disable ? reinterpret_cast<void*>(1) : nullptr);
+}
+
+static int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 一次 hook 调用的模式: 检查, 设置, 清除
+template <typename Disabled, typename Set>
+static double Measure(size_t iterations, Disabled disabled, Set set) {
+    int64_t start = NowNs();
+    for (size_t i = 0; i < iterations; i++) {
+        if (!disabled()) {
+            bool was_disabled = disabled();
+            if (!was_disabled) {
+                set(true);
+            }
+            // 阻止编译器把 TLS 读写提到循环外
+            asm volatile("" ::: "memory");
+            if (!was_disabled) {
+                set(false);
+            }
+        }
+    }
+    return static_cast<double>(NowNs() - start) / iterations;
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 0) : 100000000;
+    pthread_key_create(&g_key, nullptr);
+    DebugDisableInitialize();
+
+    // 用 lambda 传入, 两种实现都能内联到循环里
+    double key_ns = Measure(
+            iterations, [] { return KeyDisabled(); },
+            [](bool disable) { KeyDisableSet(disable); });
+    double tls_ns = Measure(
+            iterations, [] { return DebugCallsDisabled(); },
+            [](bool disable) { DebugDisableSet(disable); });
+    printf("pthread key: %.2f ns/call\n", key_ns);
+    printf("DEBUG_TLS:   %.2f ns/call (%s)\n", tls_ns,
+           DEBUG_USE_PTHREAD_KEY_TLS ? "pthread key fallback"
+                                     : "initial-exec __thread");
+    printf("saved:       %.2f ns/call\n", key_ns - tls_ns);
+    return 0;
+}
@@ -0,0 +1,87 @@
+// 多线程 malloc/free 基准: 每个线程在 64 个槽位上循环释放旧块、申请新块,
+// 输出每个线程平均每次 malloc + free 的耗时随线程数的变化.
+// 分别在加载和不加载 liballoc_hook.so, 或加载不同版本时运行, 对比 hook 的开销和扩展性:
+//   LD_PRELOAD=liballoc_hook.so ./malloc_threads [每线程次数] [线程数...]
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <vector>
+
+static constexpr size_t kSlots = 64;
+
+struct BenchArgs {
+    size_t ops;
+    std::atomic<int>* ready;
+    std::atomic<bool>* go;
+};
+
+static int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void* BenchThread(void* data) {
+    BenchArgs* args = static_cast<BenchArgs*>(data);
+    void* slots[kSlots] = {};
+    uint32_t seed = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&slots));
+
+    args->ready->fetch_add(1);
+    while (!args->go->load(std::memory_order_acquire)) {
+    }
+    for (size_t i = 0; i < args->ops; i++) {
+        // xorshift 生成 16 - 1024 字节的大小
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        size_t slot = i % kSlots;
+        free(slots[slot]);
+        slots[slot] = malloc(16 + (seed & 1008));
+    }
+    for (void* ptr : slots) {
+        free(ptr);
+    }
+    return nullptr;
+}
+
+// 返回每个线程平均每次 malloc + free 的纳秒数
+static double RunThreads(int threads, size_t ops) {
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    BenchArgs args{ops, &ready, &go};
+    std::vector<pthread_t> tids(threads);
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&tids[i], nullptr, BenchThread, &args);
+    }
+    while (ready.load() != threads) {
+    }
+    int64_t start = NowNs();
+    go.store(true, std::memory_order_release);
+    for (pthread_t tid : tids) {
+        pthread_join(tid, nullptr);
+    }
+    return static_cast<double>(NowNs() - start) / ops;
+}
+
+int main(int argc, char** argv) {
+    size_t ops = argc > 1 ? strtoul(argv[1], nullptr, 0) : 1000000;
+    std::vector<int> thread_counts;
+    for (int i = 2; i < argc; i++) {
+        thread_counts.push_back(atoi(argv[i]));
+    }
+    if (thread_counts.empty()) {
+        thread_counts = {1, 2, 4, 8};
+    }
+
+    // 先跑一轮预热, 让 hook 完成初始化, 分配器建立各线程的缓存
+    RunThreads(1, ops / 10);
+    printf("threads  ns/op (per thread)\n");
+    for (int threads : thread_counts) {
+        printf("%7d  %.1f\n", threads, RunThreads(threads, ops));
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+// 检查 dma-buf 的计数: 用 memfd 创建 udmabuf, 按下面的顺序操作, 每一步之后通过
+// checkpoint 输出 dump, 读取其中的 "current dma used" 与期望值比较.
+//   1. 创建后不 mmap 直接 close, 计数回到原值
+//   2. 再次创建, dup, mmap, 关闭两个 fd, 映射仍引用 buffer, 最后 munmap 后回到原值
+// 需要加载 liballoc_hook.so 运行, 设备上没有 /dev/udmabuf 时跳过:
+//   LD_PRELOAD=liballoc_hook.so ./udmabuf_check [dump 文件]
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/memfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "udmabuf/udmabuf.h"
+
+typedef void (*CheckpointFunc)(const char*);
+
+static constexpr size_t kBufferSize = 1 << 20;
+// dump 中的 MB 保留 6 位小数, 换算回字节有舍入误差
+static constexpr long long kToleranceBytes = 16;
+
+static CheckpointFunc g_checkpoint;
+static const char* g_dump_file;
+
+// 返回 dump 中 dma 类的当前字节数, 失败时返回 -1
+static long long DmaUsedBytes() {
+    g_checkpoint(g_dump_file);
+    FILE* file = fopen(g_dump_file, "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    long long bytes = -1;
+    char line[512];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        const char* field = strstr(line, "current dma used ");
+        double mb;
+        if (field != nullptr && sscanf(field, "current dma used %lfMB", &mb) == 1) {
+            bytes = static_cast<long long>(mb * 1024 * 1024 + 0.5);
+            break;
+        }
+    }
+    fclose(file);
+    return bytes;
+}
+
+static bool Expect(const char* step, long long expected) {
+    long long actual = DmaUsedBytes();
+    bool ok = actual >= 0 && llabs(actual - expected) <= kToleranceBytes;
+    printf("%-32s dma %lld bytes, expected %lld: %s\n", step, actual, expected,
+           ok ? "ok" : "FAILED");
+    return ok;
+}
+
+static int CreateUdmabuf(int device, int memfd) {
+    struct udmabuf_create create = {};
+    create.memfd = static_cast<__u32>(memfd);
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = kBufferSize;
+    return ioctl(device, UDMABUF_CREATE, &create);
+}
+
+int main(int argc, char** argv) {
+    g_dump_file = argc > 1 ? argv[1] : "udmabuf_check.txt";
+    g_checkpoint = reinterpret_cast<CheckpointFunc>(dlsym(RTLD_DEFAULT, "checkpoint"));
+    if (g_checkpoint == nullptr) {
+        fprintf(stderr, "checkpoint not found, run with LD_PRELOAD=liballoc_hook.so\n");
+        return 1;
+    }
+    int device = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (device < 0) {
+        printf("skip: open /dev/udmabuf failed: %s\n", strerror(errno));
+        return 0;
+    }
+    // udmabuf 要求 memfd 带 F_SEAL_SHRINK. 旧版本 libc 没有 memfd_create 的声明
+    int memfd = static_cast<int>(
+            syscall(__NR_memfd_create, "udmabuf_check", MFD_ALLOW_SEALING));
+    if (memfd < 0 || ftruncate(memfd, kBufferSize) != 0 ||
+        fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+        fprintf(stderr, "memfd setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    long long base = DmaUsedBytes();
+    if (base < 0) {
+        fprintf(stderr, "failed to read %s\n", g_dump_file);
+        return 1;
+    }
+    bool ok = true;
+
+    int buffer = CreateUdmabuf(device, memfd);
+    if (buffer < 0) {
+        fprintf(stderr, "UDMABUF_CREATE failed: %s\n", strerror(errno));
+        return 1;
+    }
+    ok &= Expect("create", base + kBufferSize);
+    close(buffer);
+    ok &= Expect("close without mmap", base);
+
+    buffer = CreateUdmabuf(device, memfd);
+    if (buffer < 0) {
+        fprintf(stderr, "UDMABUF_CREATE failed: %s\n", strerror(errno));
+        return 1;
+    }
+    ok &= Expect("create again", base + kBufferSize);
+    int dup_fd = dup(buffer);
+    ok &= Expect("dup", base + kBufferSize);
+    void* map = mmap(nullptr, kBufferSize, PROT_READ, MAP_SHARED, dup_fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+        return 1;
+    }
+    ok &= Expect("mmap", base + kBufferSize);
+    close(buffer);
+    close(dup_fd);
+    ok &= Expect("close both fds, still mapped", base + kBufferSize);
+    munmap(map, kBufferSize);
+    ok &= Expect("munmap", base);
+
+    close(memfd);
+    close(device);
+    return ok ? 0 : 1;
+}
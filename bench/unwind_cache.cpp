@@ -0,0 +1,130 @@
+// 回溯缓存的收益和正确性: 在不同递归深度上反复回溯, 对比不使用和使用 UnwindCache 时
+// 每次回溯的耗时, 并检查使用缓存得到的每一帧都与完整回溯的结果相同.
+//   ./unwind_cache [每个深度的次数] [深度...]
+// 默认深度为 16 32 64 128 256 512, 任一深度结果不一致时返回非 0.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <utility>
+#include <vector>
+
+#include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/Unwinder.h>
+
+static constexpr size_t kMaxFrames = 1024;
+
+struct DepthResult {
+    double uncached_us;
+    double cached_us;
+    size_t frames;
+    // 第一个与完整回溯不同的帧, 全部相同时为 SIZE_MAX
+    size_t mismatch;
+};
+
+static int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static size_t FirstMismatch(
+        const std::vector<unwindstack::FrameData>& expected,
+        const std::vector<unwindstack::FrameData>& actual) {
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (i >= actual.size() || expected[i].pc != actual[i].pc ||
+            expected[i].sp != actual[i].sp || expected[i].rel_pc != actual[i].rel_pc ||
+            expected[i].map_info != actual[i].map_info) {
+            return i;
+        }
+    }
+    return actual.size() == expected.size() ? SIZE_MAX : expected.size();
+}
+
+// 连续回溯 iterations 次, 返回每次的平均耗时, 最后一次的帧保存到 frames
+__attribute__((noinline)) static double TimeUnwinds(
+        unwindstack::AndroidLocalUnwinder& unwinder, unwindstack::UnwindCache* cache,
+        size_t iterations, std::vector<unwindstack::FrameData>* frames) {
+    int64_t start = NowNs();
+    for (size_t i = 0; i < iterations; i++) {
+        unwindstack::AndroidUnwinderData data(kMaxFrames);
+        // 与 hook 相同, 只取 pc 和 map, 不解析函数名
+        data.resolve_names = false;
+        data.cache = cache;
+        unwinder.Unwind(data);
+        if (i + 1 == iterations) {
+            *frames = std::move(data.frames);
+        }
+    }
+    return static_cast<double>(NowNs() - start) / iterations / 1000;
+}
+
+__attribute__((noinline)) static void Leaf(
+        unwindstack::AndroidLocalUnwinder& unwinder, size_t iterations,
+        DepthResult* result) {
+    unwindstack::UnwindCache cache;
+    // 依次为: 预热缓存 (缓存为空时等同于完整回溯, 不计入结果), 完整回溯, 使用缓存.
+    // 所有回溯都从同一个调用点发起, 后两种方式得到的每一帧都应完全相同
+    const struct {
+        unwindstack::UnwindCache* cache;
+        size_t iterations;
+    } passes[] = {{&cache, 1}, {nullptr, iterations}, {&cache, iterations}};
+    double us[3];
+    std::vector<unwindstack::FrameData> frames[3];
+    for (size_t i = 0; i < 3; i++) {
+        us[i] = TimeUnwinds(
+                unwinder, passes[i].cache, passes[i].iterations, &frames[i]);
+    }
+    result->uncached_us = us[1];
+    result->cached_us = us[2];
+    result->frames = frames[1].size();
+    result->mismatch = FirstMismatch(frames[1], frames[2]);
+}
+
+__attribute__((noinline)) static void Recurse(
+        int depth, unwindstack::AndroidLocalUnwinder& unwinder, size_t iterations,
+        DepthResult* result) {
+    if (depth == 0) {
+        Leaf(unwinder, iterations, result);
+        return;
+    }
+    Recurse(depth - 1, unwinder, iterations, result);
+    // 阻止尾调用优化, 每一层都留在栈上
+    asm volatile("" ::: "memory");
+}
+
+int main(int argc, char** argv) {
+    size_t iterations = argc > 1 ? strtoul(argv[1], nullptr, 0) : 200;
+    std::vector<int> depths;
+    for (int i = 2; i < argc; i++) {
+        depths.push_back(atoi(argv[i]));
+    }
+    if (depths.empty()) {
+        depths = {16, 32, 64, 128, 256, 512};
+    }
+
+    unwindstack::AndroidLocalUnwinder unwinder;
+    unwindstack::ErrorData error;
+    if (!unwinder.Initialize(error)) {
+        fprintf(stderr, "failed to initialize the unwinder\n");
+        return 1;
+    }
+
+    int ret = 0;
+    printf("depth  frames  uncached us  cached us  speedup  frames match\n");
+    for (int depth : depths) {
+        DepthResult result;
+        Recurse(depth, unwinder, iterations, &result);
+        bool match = result.mismatch == SIZE_MAX;
+        printf("%5d  %6zu  %11.2f  %9.2f  %6.1fx  %s", depth, result.frames,
+               result.uncached_us, result.cached_us,
+               result.uncached_us / result.cached_us, match ? "yes" : "no");
+        if (!match) {
+            printf(" (first difference at frame %zu)", result.mismatch);
+            ret = 1;
+        }
+        printf("\n");
+    }
+    return ret;
+}
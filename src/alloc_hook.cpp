@@ -1,29 +1,22 @@
 #include <sys/mman.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstdarg>
 #include <cstddef>
 
 #include <dlfcn.h>
 #include <fcntl.h>
 
 #include "DebugData.h"
+#include "IoctlClassifier.h"
 #include "PointerData.h"
 #include "malloc_debug.h"
 #include "memory_hook.h"
 
-#define RESOLVE(name)                                                              \
-    do {                                                                           \
-        if (m_sys_##name == nullptr) {                                             \
-            void* handle = dlopen("libc.so", RTLD_LAZY);                           \
-            if (handle) {                                                          \
-                auto addr = dlsym(handle, #name);                                  \
-                if (addr) {                                                        \
-                    m_sys_##name = reinterpret_cast<decltype(m_sys_##name)>(addr); \
-                }                                                                  \
-                dlclose(handle);                                                   \
-            }                                                                      \
-        }                                                                          \
-    } while (0)
+__attribute__((constructor(101))) static void resolve_sys_allocator() {
+    ResolveSysAllocator();
+}
 
 struct InitState {
     InitState() { allocHook_setup = true; }
@@ -58,7 +51,18 @@ public:
         return debug_mmap64(addr, size, prot, flags, fd, offset);
     }
 
-    void checkpoint(const char* file_name) { return debug_dump_heap(file_name); }
+    int close(int fd) { return debug_close(fd); }
+    int dup(int fd) { return debug_dup(fd); }
+    int dup2(int old_fd, int new_fd) { return debug_dup2(old_fd, new_fd); }
+    int dup3(int old_fd, int new_fd, int flags) {
+        return debug_dup3(old_fd, new_fd, flags);
+    }
+    int fcntl(int fd, int cmd, void* arg) { return debug_fcntl(fd, cmd, arg); }
+
+    void checkpoint(const char* file_name) { return debug_dump_heap(file_name, true); }
+    void checkpoint_async(const char* file_name) {
+        return debug_dump_heap(file_name, false);
+    }
 
     static AllocHook& inst();
 
@@ -84,7 +88,9 @@ __attribute__((constructor(201))) void mark_init_done() {
 extern "C" {
 // 程序初始化会间接调用 malloc 和 free
 void* malloc(size_t size) {
-    RESOLVE(malloc);
+    if (!EnsureSysAllocator()) {
+        return BootstrapMalloc(size);
+    }
     if (InitState::allocHook_setup) {
         return m_sys_malloc(size);
     }
@@ -92,7 +98,9 @@ void* malloc(size_t size) {
 }
 
 void free(void* ptr) {
-    RESOLVE(free);
+    if (__builtin_expect(IsBootstrapPointer(ptr), 0) || !EnsureSysAllocator()) {
+        return;
+    }
     if (InitState::allocHook_setup) {
         return m_sys_free(ptr);
     }
@@ -101,7 +109,9 @@ void free(void* ptr) {
 
 // calloc 和 realloc 属于用户级函数
 void* calloc(size_t a, size_t b) {
-    RESOLVE(calloc);
+    if (!EnsureSysAllocator()) {
+        return BootstrapCalloc(a, b);
+    }
     if (InitState::allocHook_setup) {
         return m_sys_calloc(a, b);
     }
@@ -109,22 +119,27 @@ void* calloc(size_t a, size_t b) {
 }
 
 void* realloc(void* ptr, size_t size) {
-    RESOLVE(realloc);
+    if (__builtin_expect(IsBootstrapPointer(ptr), 0) || !EnsureSysAllocator()) {
+        return BootstrapRealloc(ptr, size);
+    }
     if (InitState::allocHook_setup) {
         return m_sys_realloc(ptr, size);
     }
     return AllocHook::inst().realloc(ptr, size);
 }
 
-void* memalign(size_t alignment, size_t bytes)  {
-    RESOLVE(memalign);
+void* memalign(size_t alignment, size_t bytes) {
+    if (!EnsureSysAllocator()) {
+        return nullptr;
+    }
     return AllocHook::inst().memalign(alignment, bytes);
 }
 
 // 进程初始化 和 debug init 的过程不应该调用 posix_memalign
 int posix_memalign(void** ptr, size_t alignment, size_t size) {
-    RESOLVE(memalign);
-    RESOLVE(posix_memalign);
+    if (!EnsureSysAllocator()) {
+        return ENOMEM;
+    }
     return AllocHook::inst().posix_memalign(ptr, alignment, size);
 }
 
@@ -149,6 +164,10 @@ int ioctl(int fd, int request, ...) {
     void* arg = va_arg(ap, void*);
     va_end(ap);
 
+    // 不需要跟踪的请求不加锁也不写 TLS, 直接进内核
+    if (!IsTrackedIoctl(request)) {
+        return (int)syscall(SYS_ioctl, fd, request, arg);
+    }
     return AllocHook::inst().ioctl(fd, request, arg);
 }
 
@@ -160,7 +179,53 @@ void* mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset)
     return result;
 }
 
+// fd 生命周期 hook. 大多数 fd 与 dma-buf 无关, 只测一次位图就直接转发给 libc,
+// 不加锁也不写 TLS.
+int close(int fd) {
+    if (!DmaBufTable::MaybeDmaBufFd(fd)) {
+        return SysClose(fd);
+    }
+    return AllocHook::inst().close(fd);
+}
+
+int dup(int fd) {
+    if (!DmaBufTable::MaybeDmaBufFd(fd)) {
+        return SysDup(fd);
+    }
+    return AllocHook::inst().dup(fd);
+}
+
+int dup2(int old_fd, int new_fd) {
+    if (!DmaBufTable::MaybeDmaBufFd(old_fd) && !DmaBufTable::MaybeDmaBufFd(new_fd)) {
+        return SysDup2(old_fd, new_fd);
+    }
+    return AllocHook::inst().dup2(old_fd, new_fd);
+}
+
+int dup3(int old_fd, int new_fd, int flags) {
+    if (!DmaBufTable::MaybeDmaBufFd(old_fd) && !DmaBufTable::MaybeDmaBufFd(new_fd)) {
+        return SysDup3(old_fd, new_fd, flags);
+    }
+    return AllocHook::inst().dup3(old_fd, new_fd, flags);
+}
+
+int fcntl(int fd, int cmd, ...) {
+    va_list ap;
+    va_start(ap, cmd);
+    void* arg = va_arg(ap, void*);
+    va_end(ap);
+
+    if ((cmd != F_DUPFD && cmd != F_DUPFD_CLOEXEC) || !DmaBufTable::MaybeDmaBufFd(fd)) {
+        return SysFcntl(fd, cmd, arg);
+    }
+    return AllocHook::inst().fcntl(fd, cmd, arg);
+}
+
 void checkpoint(const char* file_name) {
     AllocHook::inst().checkpoint(file_name);
 }
+
+void checkpoint_async(const char* file_name) {
+    AllocHook::inst().checkpoint_async(file_name);
+}
 }
\ No newline at end of file
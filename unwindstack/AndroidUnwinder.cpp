@@ -169,6 +169,9 @@ bool AndroidUnwinder::Unwind(Regs* initial_regs, AndroidUnwinderData& data) {
                     process_memory_);
   unwinder.SetJitDebug(jit_debug_.get());
   unwinder.SetDexFiles(dex_files_.get());
+  unwinder.SetResolveNames(data.resolve_names);
+  unwinder.SetFilter(&filter_);
+  unwinder.SetCache(data.cache);
   unwinder.Unwind(data.show_all_frames ? nullptr : &initial_map_names_to_skip_,
                   &map_suffixes_to_ignore_, &mangle_function_to_exit_);
   data.frames = unwinder.ConsumeFrames();
@@ -191,6 +194,9 @@ bool AndroidLocalUnwinder::InternalUnwind(std::optional<pid_t> tid, AndroidUnwin
   ThreadUnwinder unwinder(data.max_frames.value_or(max_frames_), maps_.get(), process_memory_);
   unwinder.SetJitDebug(jit_debug_.get());
   unwinder.SetDexFiles(dex_files_.get());
+  unwinder.SetResolveNames(data.resolve_names);
+  unwinder.SetFilter(&filter_);
+  unwinder.SetCache(data.cache);
   std::unique_ptr<Regs>* initial_regs = nullptr;
   if (data.saved_initial_regs) {
     initial_regs = &data.saved_initial_regs.value();
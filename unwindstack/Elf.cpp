@@ -116,6 +116,18 @@ bool Elf::GetFunctionName(uint64_t addr, SharedString* name, uint64_t* func_offs
                      gnu_debugdata_interface_->GetFunctionName(addr, name, func_offset)));
 }
 
+void Elf::GetFunctionRanges(const std::vector<std::string>& names,
+                            std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!valid_) {
+    return;
+  }
+  interface_->GetFunctionRanges(names, ranges);
+  if (gnu_debugdata_interface_) {
+    gnu_debugdata_interface_->GetFunctionRanges(names, ranges);
+  }
+}
+
 bool Elf::GetGlobalVariableOffset(const std::string& name, uint64_t* memory_offset) {
   if (!valid_) {
     return false;
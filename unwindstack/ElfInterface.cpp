@@ -433,6 +433,14 @@ bool ElfInterfaceImpl<ElfTypes>::GetGlobalVariable(const std::string& name,
   return false;
 }
 
+template <typename ElfTypes>
+void ElfInterfaceImpl<ElfTypes>::GetFunctionRanges(
+    const std::vector<std::string>& names, std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  for (const auto symbol : symbols_) {
+    symbol->template GetFunctionRanges<SymType>(memory_, names, ranges);
+  }
+}
+
 bool ElfInterface::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
                         bool* is_signal_frame) {
   last_error_.code = ERROR_NONE;
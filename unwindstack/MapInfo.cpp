@@ -378,6 +378,12 @@ MapInfo::~MapInfo() {
     delete elf_fields->build_id_.load();
     delete elf_fields;
   }
+  MapFunctionRanges* ranges = exit_ranges_.load();
+  while (ranges != nullptr) {
+    MapFunctionRanges* next = ranges->next;
+    delete ranges;
+    ranges = next;
+  }
 }
 
 std::string MapInfo::GetFullName() {
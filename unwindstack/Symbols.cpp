@@ -194,10 +194,48 @@ bool Symbols::GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* m
   return false;
 }
 
+template <typename SymType>
+void Symbols::GetFunctionRanges(Memory* elf_memory, const std::vector<std::string>& names,
+                                std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  size_t max_name_length = 0;
+  for (const auto& name : names) {
+    max_name_length = std::max(max_name_length, name.size());
+  }
+  if (max_name_length == 0) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < count_; i++) {
+    SymType entry;
+    if (!elf_memory->ReadFully(offset_ + i * entry_size_, &entry, sizeof(entry))) {
+      return;
+    }
+    if (!IsFunc(&entry) || entry.st_size == 0) {
+      continue;
+    }
+    uint64_t str_offset = str_offset_ + entry.st_name;
+    if (str_offset >= str_end_) {
+      continue;
+    }
+    // Names longer than any wanted name fail to read and are skipped.
+    std::string symbol;
+    if (elf_memory->ReadString(str_offset, &symbol,
+                               std::min<uint64_t>(max_name_length + 1, str_end_ - str_offset)) &&
+        std::find(names.begin(), names.end(), symbol) != names.end()) {
+      ranges->emplace_back(entry.st_value, entry.st_value + entry.st_size);
+    }
+  }
+}
+
 // Instantiate all of the needed template functions.
 template bool Symbols::GetName<Elf32_Sym>(uint64_t, Memory*, SharedString*, uint64_t*);
 template bool Symbols::GetName<Elf64_Sym>(uint64_t, Memory*, SharedString*, uint64_t*);
 
 template bool Symbols::GetGlobal<Elf32_Sym>(Memory*, const std::string&, uint64_t*);
 template bool Symbols::GetGlobal<Elf64_Sym>(Memory*, const std::string&, uint64_t*);
+
+template void Symbols::GetFunctionRanges<Elf32_Sym>(Memory*, const std::vector<std::string>&,
+                                                    std::vector<std::pair<uint64_t, uint64_t>>*);
+template void Symbols::GetFunctionRanges<Elf64_Sym>(Memory*, const std::vector<std::string>&,
+                                                    std::vector<std::pair<uint64_t, uint64_t>>*);
 }  // namespace unwindstack
@@ -23,6 +23,8 @@
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/SharedString.h>
 
@@ -49,6 +51,12 @@ class Symbols {
   template <typename SymType>
   bool GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* memory_address);
 
+  // Appends the [start, end) address range of every function symbol whose name
+  // is in |names|. This is a linear scan, callers are expected to cache the result.
+  template <typename SymType>
+  void GetFunctionRanges(Memory* elf_memory, const std::vector<std::string>& names,
+                         std::vector<std::pair<uint64_t, uint64_t>>* ranges);
+
   void ClearCache() {
     symbols_.clear();
     remap_.reset();
@@ -24,8 +24,10 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <string_view>
 
 #include <android-base/file.h>
 #include <android-base/stringprintf.h>
@@ -105,28 +107,134 @@ FrameData* Unwinder::FillInFrame(std::shared_ptr<MapInfo>& map_info, Elf* /*elf*
   return frame;
 }
 
-static bool ShouldStop(const std::vector<std::string>* map_suffixes_to_ignore,
-                       const std::string& map_name) {
-  if (map_suffixes_to_ignore == nullptr) {
-    return false;
+static std::atomic_uint64_t g_next_filter_id = 1;
+
+UnwindFilter::UnwindFilter(const std::vector<std::string>* initial_map_names_to_skip,
+                           const std::vector<std::string>* map_suffixes_to_ignore,
+                           const std::vector<std::string>* mangle_function_to_exit)
+    : id_(g_next_filter_id.fetch_add(1, std::memory_order_relaxed)),
+      initial_map_names_to_skip_(initial_map_names_to_skip),
+      map_suffixes_to_ignore_(map_suffixes_to_ignore),
+      mangle_function_to_exit_(mangle_function_to_exit) {}
+
+static bool Contains(const std::vector<std::string>* list, std::string_view value) {
+  return list != nullptr && std::find(list->begin(), list->end(), value) != list->end();
+}
+
+uint64_t UnwindFilter::LoadFlags(MapInfo* map_info) const {
+  uint64_t value = map_info->filter_flags().load(std::memory_order_acquire);
+  if (__builtin_expect((value >> kIdShift) == id_, 1)) {
+    return value;
   }
-  auto pos = map_name.find_last_of('.');
-  if (pos == std::string::npos) {
-    return false;
+
+  std::string_view name(map_info->name());
+  uint32_t flags = 0;
+  auto slash = name.find_last_of('/');
+  if (Contains(initial_map_names_to_skip_,
+               slash == std::string_view::npos ? name : name.substr(slash + 1))) {
+    flags |= kSkipMap;
+  }
+  auto dot = name.find_last_of('.');
+  if (dot != std::string_view::npos && Contains(map_suffixes_to_ignore_, name.substr(dot + 1))) {
+    flags |= kStopMap;
   }
+  value = (id_ << kIdShift) | flags;
+  map_info->filter_flags().store(value, std::memory_order_release);
+  return value;
+}
 
-  return std::find(map_suffixes_to_ignore->begin(), map_suffixes_to_ignore->end(),
-                   map_name.substr(pos + 1)) != map_suffixes_to_ignore->end();
+uint32_t UnwindFilter::MapFlags(MapInfo* map_info) const {
+  return static_cast<uint32_t>(LoadFlags(map_info) & (kSkipMap | kStopMap));
 }
 
-static bool ShouldExit(const std::vector<std::string>* mangle_function_to_exit,
-                       const char* function_name) {
-  if (mangle_function_to_exit == nullptr || function_name == nullptr) {
+const MapFunctionRanges* UnwindFilter::ExitRanges(MapInfo* map_info) const {
+  for (const MapFunctionRanges* ranges = map_info->exit_ranges().load(std::memory_order_acquire);
+       ranges != nullptr; ranges = ranges->next) {
+    if (ranges->filter_id == id_) {
+      return ranges;
+    }
+  }
+  return nullptr;
+}
+
+bool UnwindFilter::InExitFunction(MapInfo* map_info, Elf* elf, uint64_t rel_pc) const {
+  if (mangle_function_to_exit_ == nullptr || mangle_function_to_exit_->empty() ||
+      map_info == nullptr || elf == nullptr) {
+    return false;
+  }
+  uint64_t value = LoadFlags(map_info);
+  if (!(value & kExitResolved)) {
+    // Look the symbols up once per map. The ranges are published before the
+    // flag, so a reader that sees kHasExit always finds them.
+    uint64_t resolved = value | kExitResolved;
+    if (ExitRanges(map_info) != nullptr) {
+      resolved |= kHasExit;
+    } else {
+      auto* ranges = new MapFunctionRanges{id_, {}, nullptr};
+      elf->GetFunctionRanges(*mangle_function_to_exit_, &ranges->ranges);
+      if (ranges->ranges.empty()) {
+        delete ranges;
+      } else {
+        auto& head = map_info->exit_ranges();
+        ranges->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(ranges->next, ranges, std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+        }
+        resolved |= kHasExit;
+      }
+    }
+    // Losing the race to another filter only means this is recomputed later.
+    map_info->filter_flags().compare_exchange_strong(value, resolved, std::memory_order_acq_rel);
+    value = resolved;
+  }
+  // Most elf files contain none of the exit functions and never get here.
+  if (!(value & kHasExit)) {
     return false;
   }
+  const MapFunctionRanges* ranges = ExitRanges(map_info);
+  if (ranges == nullptr) {
+    return false;
+  }
+  for (const auto& range : ranges->ranges) {
+    if (rel_pc >= range.first && rel_pc < range.second) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  return std::find(mangle_function_to_exit->begin(), mangle_function_to_exit->end(),
-                   function_name) != mangle_function_to_exit->end();
+bool Unwinder::SpliceCachedFrames() {
+  size_t num_frames = frames_.size();
+  const auto& cached = cache_->frames_;
+  if (num_frames < 2 || cached.size() < 2 || cache_->resolve_names_ != resolve_names_) {
+    return false;
+  }
+  const FrameData& inner = frames_[num_frames - 2];
+  const FrameData& outer = frames_[num_frames - 1];
+  // The stack grows down, so the cached frames are sorted by sp. A frame
+  // running on a different stack (e.g. a signal stack) simply never matches.
+  auto entry = std::lower_bound(
+      cached.begin() + 1, cached.end(), outer.sp,
+      [](const FrameData& frame, uint64_t sp) { return frame.sp < sp; });
+  for (; entry != cached.end() && entry->sp == outer.sp; ++entry) {
+    auto prev = entry - 1;
+    if (entry->pc != outer.pc || prev->pc != inner.pc || prev->sp != inner.sp) {
+      continue;
+    }
+    size_t suffix = cached.end() - (entry + 1);
+    size_t room = max_frames_ - num_frames;
+    // A cached unwind that was cut short cannot complete a shorter one.
+    if (cache_->error_.code == ERROR_MAX_FRAMES_EXCEEDED && suffix < room) {
+      return false;
+    }
+    for (auto it = entry + 1; it != cached.end() && frames_.size() < max_frames_; ++it) {
+      frames_.push_back(*it);
+      frames_.back().num = frames_.size() - 1;
+    }
+    last_error_ = suffix > room ? ErrorData{ERROR_MAX_FRAMES_EXCEEDED, 0} : cache_->error_;
+    return true;
+  }
+  return false;
 }
 
 void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
@@ -144,6 +252,10 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
     regs_->fallback_pc();
   }
 
+  UnwindFilter local_filter(initial_map_names_to_skip, map_suffixes_to_ignore,
+                            mangle_function_to_exit);
+  const UnwindFilter* filter = filter_ != nullptr ? filter_ : &local_filter;
+
   bool return_address_attempt = false;
   bool adjust_pc = false;
   for (; frames_.size() < max_frames_;) {
@@ -155,6 +267,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
     uint64_t step_pc;
     uint64_t rel_pc;
     Elf* elf;
+    bool jit_elf_frame = false;
     bool ignore_frame = false;
     if (map_info == nullptr) {
       step_pc = regs_->pc();
@@ -166,11 +279,10 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
       }
       elf = nullptr;
     } else {
+      uint32_t map_flags = filter->MapFlags(map_info.get());
       ignore_frame =
-          initial_map_names_to_skip != nullptr &&
-          std::find(initial_map_names_to_skip->begin(), initial_map_names_to_skip->end(),
-                    android::base::Basename(map_info->name())) != initial_map_names_to_skip->end();
-      if (!ignore_frame && ShouldStop(map_suffixes_to_ignore, map_info->name())) {
+          initial_map_names_to_skip != nullptr && (map_flags & UnwindFilter::kSkipMap);
+      if (!ignore_frame && (map_flags & UnwindFilter::kStopMap)) {
         break;
       }
       elf = map_info->GetElf(process_memory_, arch_);
@@ -196,6 +308,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
           // The jit debug information requires a non relative adjusted pc.
           step_pc = adjusted_jit_pc;
           elf = jit_elf;
+          jit_elf_frame = true;
         }
       }
     }
@@ -265,11 +378,15 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
         frame->function_name = "";
         frame->function_offset = 0;
       }
-      
-      if (ShouldExit(mangle_function_to_exit, frame->function_name.c_str())) {
+
+      if (!jit_elf_frame && filter->InExitFunction(map_info.get(), elf, step_pc)) {
         last_error_.code = ERROR_EXIT_FUNC;
         break;
       }
+
+      if (cache_ != nullptr && !return_address_attempt && SpliceCachedFrames()) {
+        break;
+      }
     }
 
     if (finished) {
@@ -311,6 +428,12 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
       break;
     }
   }
+
+  if (cache_ != nullptr) {
+    cache_->frames_.assign(frames_.begin(), frames_.end());
+    cache_->error_ = last_error_;
+    cache_->resolve_names_ = resolve_names_;
+  }
 }
 
 std::string Unwinder::FormatFrame(const FrameData& frame) const {
@@ -54,6 +54,11 @@ struct AndroidUnwinderData {
   std::optional<std::unique_ptr<Regs>> saved_initial_regs;
   const std::optional<size_t> max_frames;
   const bool show_all_frames = false;
+  // When false, frames carry pcs and maps only; function names are left empty.
+  bool resolve_names = true;
+  // Opt-in: reuse the outer frames of the previous unwind that used this
+  // cache. Only share a cache between unwinds of the same thread.
+  UnwindCache* cache = nullptr;
 };
 
 class AndroidUnwinder {
@@ -95,6 +100,9 @@ class AndroidUnwinder {
 
   FrameData BuildFrameFromPcOnly(uint64_t pc);
 
+  // The compiled skip/stop/exit lists, for callers that walk frames themselves.
+  const UnwindFilter& filter() const { return filter_; }
+
   static AndroidUnwinder* Create(pid_t pid);
 
  protected:
@@ -108,6 +116,8 @@ class AndroidUnwinder {
   std::vector<std::string> initial_map_names_to_skip_;
   std::vector<std::string> map_suffixes_to_ignore_;
   std::vector<std::string> mangle_function_to_exit_;
+  UnwindFilter filter_{&initial_map_names_to_skip_, &map_suffixes_to_ignore_,
+                       &mangle_function_to_exit_};
   std::once_flag initialize_;
   bool initialize_status_ = false;
 
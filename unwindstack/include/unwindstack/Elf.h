@@ -23,6 +23,8 @@
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/Arch.h>
 #include <unwindstack/ElfInterface.h>
@@ -60,6 +62,10 @@ class Elf {
 
   bool GetGlobalVariableOffset(const std::string& name, uint64_t* memory_offset);
 
+  // Appends the [start, end) address ranges of the functions named in |names|.
+  void GetFunctionRanges(const std::vector<std::string>& names,
+                         std::vector<std::pair<uint64_t, uint64_t>>* ranges);
+
   uint64_t GetRelPc(uint64_t pc, MapInfo* map_info);
 
   bool StepIfSignalHandler(uint64_t rel_pc, Regs* regs, Memory* process_memory);
@@ -23,6 +23,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <unwindstack/DwarfSection.h>
@@ -83,6 +84,9 @@ class ElfInterface {
 
   virtual bool GetGlobalVariable(const std::string& name, uint64_t* memory_address) = 0;
 
+  virtual void GetFunctionRanges(const std::vector<std::string>&,
+                                 std::vector<std::pair<uint64_t, uint64_t>>*) {}
+
   virtual std::string GetBuildID() = 0;
 
   virtual bool Step(uint64_t rel_pc, Regs* regs, Memory* process_memory, bool* finished,
@@ -210,6 +214,9 @@ class ElfInterfaceImpl : public ElfInterface {
 
   bool GetGlobalVariable(const std::string& name, uint64_t* memory_address) override;
 
+  void GetFunctionRanges(const std::vector<std::string>& names,
+                         std::vector<std::pair<uint64_t, uint64_t>>* ranges) override;
+
   std::string GetBuildID() override { return ReadBuildID(); }
 
   static void GetMaxSize(Memory* memory, uint64_t* size);
@@ -23,6 +23,8 @@
 #include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <unwindstack/Elf.h>
 #include <unwindstack/SharedString.h>
@@ -31,6 +33,16 @@ namespace unwindstack {
 
 class MemoryFileAtOffset;
 
+// Elf relative pc ranges compiled by one UnwindFilter for one map. Never
+// modified after being published, so readers test them without a lock.
+struct MapFunctionRanges {
+  uint64_t filter_id;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  // Ranges of other filters stay alive until the map is destroyed, since
+  // another thread may still be reading them.
+  MapFunctionRanges* next;
+};
+
 // Represents virtual memory map (as obtained from /proc/*/maps).
 //
 // Note that we have to be surprisingly careful with memory usage here,
@@ -206,6 +218,15 @@ class MapInfo {
 
   inline bool IsBlank() { return offset() == 0 && flags() == 0 && name().empty(); }
 
+  // Compact identifier assigned by callers that record frames as raw pcs and
+  // symbolize later. Zero means not assigned yet.
+  inline uint32_t user_id() const { return user_id_.load(std::memory_order_acquire); }
+  inline void set_user_id(uint32_t id) { user_id_.store(id, std::memory_order_release); }
+
+  // Results cached by UnwindFilter for this map.
+  inline std::atomic_uint64_t& filter_flags() { return filter_flags_; }
+  inline std::atomic<MapFunctionRanges*>& exit_ranges() { return exit_ranges_; }
+
   // Returns elf_fields_. It will create the object if it is null.
   ElfFields& GetElfFields();
 
@@ -223,6 +244,9 @@ class MapInfo {
   uint64_t end_ = 0;
   uint64_t offset_ = 0;
   uint16_t flags_ = 0;
+  std::atomic_uint32_t user_id_ = 0;
+  std::atomic_uint64_t filter_flags_ = 0;
+  std::atomic<MapFunctionRanges*> exit_ranges_ = nullptr;
   SharedString name_;
 
   std::atomic<ElfFields*> elf_fields_;
@@ -52,6 +52,113 @@ struct FrameData {
   std::shared_ptr<MapInfo> map_info; // 映射信息
 };
 
+// The skip, stop and exit lists given to Unwinder::Unwind() in a form that
+// is cheap to test per frame. Map name matches are computed once per MapInfo
+// and cached in it as flag bits, and the exit functions are resolved to pc
+// ranges once per Elf, so no check needs the frame's function name.
+// The vectors are not copied and must outlive the filter.
+class UnwindFilter {
+ public:
+  static constexpr uint32_t kSkipMap = 0x1;  // Basename in initial_map_names_to_skip.
+  static constexpr uint32_t kStopMap = 0x2;  // Suffix in map_suffixes_to_ignore.
+
+  UnwindFilter(const std::vector<std::string>* initial_map_names_to_skip,
+               const std::vector<std::string>* map_suffixes_to_ignore,
+               const std::vector<std::string>* mangle_function_to_exit);
+
+  uint32_t MapFlags(MapInfo* map_info) const;
+
+  // The elf must be the one belonging to map_info, and rel_pc is the
+  // adjusted pc as passed to Elf::GetFunctionName().
+  bool InExitFunction(MapInfo* map_info, Elf* elf, uint64_t rel_pc) const;
+
+ private:
+  static constexpr uint32_t kExitResolved = 0x4;
+  static constexpr uint32_t kHasExit = 0x8;
+  // The id of the filter that computed the flags is kept above them.
+  static constexpr uint64_t kIdShift = 8;
+
+  uint64_t LoadFlags(MapInfo* map_info) const;
+  const MapFunctionRanges* ExitRanges(MapInfo* map_info) const;
+
+  uint64_t id_;
+  const std::vector<std::string>* initial_map_names_to_skip_;
+  const std::vector<std::string>* map_suffixes_to_ignore_;
+  const std::vector<std::string>* mangle_function_to_exit_;
+};
+
+// The frames of the previous unwind of one thread. When an unwind reaches a
+// frame whose pc and sp, together with those of the frame before it, match
+// two consecutive cached frames, the remaining outer frames are copied from
+// the cache instead of being unwound again.
+//
+// The match is a heuristic: if two different call paths reach the same two
+// frames at exactly the same stack addresses, the outer frames of the older
+// path are reused. Only share a cache between unwinds of the same thread.
+//
+// By default the cached frames live on the heap. A cache used from inside a
+// malloc hook can supply its own memory functions so that the cache stays
+// off the heap it is measuring.
+struct UnwindCacheMemory {
+  void* (*allocate)(size_t bytes);
+  void (*deallocate)(void* ptr, size_t bytes);
+};
+
+template <typename T>
+class UnwindCacheAllocator {
+ public:
+  using value_type = T;
+
+  explicit UnwindCacheAllocator(const UnwindCacheMemory* memory) noexcept : memory_(memory) {}
+  template <typename U>
+  UnwindCacheAllocator(const UnwindCacheAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+  T* allocate(size_t n) {
+    if (memory_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(memory_->allocate(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t n) {
+    if (memory_ == nullptr) {
+      ::operator delete(ptr);
+    } else {
+      memory_->deallocate(ptr, n * sizeof(T));
+    }
+  }
+
+  template <typename U>
+  bool operator==(const UnwindCacheAllocator<U>& other) const noexcept {
+    return memory_ == other.memory_;
+  }
+  template <typename U>
+  bool operator!=(const UnwindCacheAllocator<U>& other) const noexcept {
+    return memory_ != other.memory_;
+  }
+
+ private:
+  template <typename U>
+  friend class UnwindCacheAllocator;
+
+  const UnwindCacheMemory* memory_;
+};
+
+class UnwindCache {
+ public:
+  // The memory functions are not copied and must outlive the cache.
+  explicit UnwindCache(const UnwindCacheMemory* memory = nullptr)
+      : frames_(UnwindCacheAllocator<FrameData>(memory)) {}
+
+  void Clear() { frames_.clear(); }
+
+ private:
+  friend class Unwinder;
+
+  std::vector<FrameData, UnwindCacheAllocator<FrameData>> frames_;
+  ErrorData error_;
+  bool resolve_names_ = true;
+};
+
 class Unwinder {
  public:
   Unwinder(size_t max_frames, Maps* maps, Regs* regs, std::shared_ptr<Memory> process_memory)
@@ -102,6 +209,16 @@ class Unwinder {
   // set to an empty string and the function offset being set to zero.
   void SetResolveNames(bool resolve) { resolve_names_ = resolve; }
 
+  // Use a long lived filter instead of building one for every Unwind() call,
+  // so the results cached in MapInfo and Elf are reused. It must have been
+  // built from the same lists that are passed to Unwind(). A null
+  // initial_map_names_to_skip still disables skipping.
+  void SetFilter(const UnwindFilter* filter) { filter_ = filter; }
+
+  // Opt-in: reuse outer frames recorded by the previous unwind that used
+  // this cache, see UnwindCache. The cache is updated by every Unwind() call.
+  void SetCache(UnwindCache* cache) { cache_ = cache; }
+
   void SetDisplayBuildID(bool display_build_id) { display_build_id_ = display_build_id; }
 
   void SetDexFiles(DexFiles* dex_files);
@@ -135,6 +252,7 @@ class Unwinder {
   }
 
   void FillInDexFrame();
+  bool SpliceCachedFrames();
   FrameData* FillInFrame(std::shared_ptr<MapInfo>& map_info, Elf* elf, uint64_t rel_pc,
                          uint64_t pc_adjustment);
 
@@ -145,6 +263,8 @@ class Unwinder {
   std::shared_ptr<Memory> process_memory_;
   JitDebug* jit_debug_ = nullptr;
   DexFiles* dex_files_ = nullptr;
+  const UnwindFilter* filter_ = nullptr;
+  UnwindCache* cache_ = nullptr;
   bool resolve_names_ = true;
   bool display_build_id_ = false;
   ErrorData last_error_;